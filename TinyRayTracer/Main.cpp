@@ -5,31 +5,73 @@
 #include <cmath>
 #include <limits>
 #include <vector>
+#include <algorithm>
 #include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 #include "libs/Geometry.h"
 #include "libs/Sphere.h"
 #include "libs/Light.h"
+#include "libs/Parallel.h"
+#include "libs/RenderStats.h"
+#include "libs/Framebuffer.h"
+#include "libs/Options.h"
+#include "libs/Timer.h"
+#include "libs/RayBatch.h"
+#include "libs/Microfacet.h"
+#include "libs/LightSet.h"
+#include "libs/Scene.h"
+#include "libs/SceneGenerator.h"
+#include "libs/IntersectKernels.h"
+#include "libs/PerfCounters.h"
+#include "libs/PerfHistory.h"
+#include "libs/Statistics.h"
+#include "libs/CostMap.h"
+#include "libs/TraceRecorder.h"
+#include "libs/EnergyMeter.h"
+#include "libs/Image.h"
+#include "libs/Checkpoint.h"
+#include "libs/FrameStream.h"
+#include "libs/SharedFramebuffer.h"
+#include "libs/AsyncWriter.h"
+#include "libs/Bake.h"
+#include "libs/Importance.h"
+#include "libs/Checkerboard.h"
+#include "libs/Upsample.h"
 
-struct Hit
+// The tracing pipeline below is templated on the scalar type T of the
+// geometry (rays, hit points, spheres). Colors, materials and lights stay in
+// float. Float-only fast paths (SoA light blocks with AVX, batched tracing)
+// are plain overloads picked over the templates for T = float.
+//
+template <typename T> struct HitT
 {
-    Vec3f point;
-    Vec3f normal;
+    vec<3, T> point;
+    vec<3, T> normal;
     Material material;
 
-    Hit() : point(), normal(), material() {}
+    HitT() : point(), normal(), material() {}
 };
 
-Vec3f Reflect(const Vec3f& direction, const Vec3f& normal)
+typedef HitT<float> Hit;
+
+template <typename T> vec<3, T> Reflect(const vec<3, T>& direction, const vec<3, T>& normal)
 {
     return direction - (normal * 2.0f) * (direction * normal);
 }
 
-Vec3f Refract(const Vec3f& direction, const Vec3f& normal, const float& refractiveIndex) // Snell's law.
+template <typename T> vec<3, T> Refract(const vec<3, T>& direction, const vec<3, T>& normal, const float& refractiveIndex) // Snell's law.
 {
-    Vec3f n = normal;
-    float r = 1.0f / refractiveIndex;
-    float c = - (n * direction);
+    vec<3, T> n = normal;
+    T r = T(1.0f) / refractiveIndex;
+    T c = - (n * direction);
 
     if (c < 0)
     {
@@ -42,164 +84,2200 @@ Vec3f Refract(const Vec3f& direction, const Vec3f& normal, const float& refracti
     // the result inside the square root will be negative,
     // and we will have to deal with imaginary values.
     //
-    float k = (r * r) * (1 - (c * c));
-    float s = sqrtf(1.0f - k);
+    T k = (r * r) * (1 - (c * c));
+    T s = std::sqrt(T(1.0f) - k);
 
     return (direction * r) + (n * ((r * c) - s));
 }
 
-bool SceneIntersect(const Vec3f& origin, const Vec3f& direction, const std::vector<Sphere>& spheres, Hit& hitInfo)
+const int NoPrimitive    = -2;
+const int PlanePrimitive = -1; // Indices from 0 are spheres.
+
+// Closest hit found while scanning the primitives: only the distance and the
+// primitive are kept, the full Hit is built once by FinalizeHit. Any
+// acceleration structure reports its result through this same record.
+//
+template <typename T> struct ClosestHitT
 {
-    float spheresDistance = std::numeric_limits<float>::max();
-    float checkerboardDistance = std::numeric_limits<float>::max();
-    
+    T t;
+    int primitive;
+
+    ClosestHitT() : t(std::numeric_limits<T>::max()), primitive(NoPrimitive) {}
+};
+
+template <typename T> bool SceneIntersectClosest(const vec<3, T>& origin, const vec<3, T>& direction, const SceneT<T>& scene, ClosestHitT<T>& closest, RenderStats& stats)
+{
+    const std::vector<SphereT<T> >& spheres = scene.m_Spheres;
+
+    stats.m_IntersectionTests += spheres.size() + 1;
+
     for (size_t i = 0; i < spheres.size(); i++)
     {
-        float t;
+        T t;
 
-        if (spheres[i].RayIntersect(origin, direction, t) && t < spheresDistance)
+        if (spheres[i].RayIntersect(origin, direction, t) && t < closest.t)
         {
-            spheresDistance = t;
+            closest.t = t;
+            closest.primitive = (int)i;
+        }
+    }
+
+    T d;
+
+    if (scene.m_Checkerboard.RayIntersect(origin, direction, d) && d < closest.t) // Drawning a plane (board).
+    {
+        closest.t = d;
+        closest.primitive = PlanePrimitive;
+    }
+
+    return closest.t < 1000; // Why "1000" here?
+}
+
+// Mixed precision traversal. Positions are double, but the primitives are
+// tested in float, with the widest SIMD kernel, in the eye-relative copy of
+// the scene: only the ray origin is moved there in T. The distances found
+// are float estimates that FinalizeHit refines.
+//
+template <typename T> bool SceneIntersectClosestRelative(const vec<3, T>& origin, const vec<3, T>& direction, const SceneT<T>& scene, ClosestHitT<T>& closest, RenderStats& stats)
+{
+    const Vec3f relative = Vec3f(origin - scene.m_Eye), d = Vec3f(direction);
+    float t;
+
+    stats.m_IntersectionTests += scene.m_Spheres.size() + 1;
+
+    const int sphere = IntersectSpheres(scene.m_RelativeSpheres, relative, d, 1000.0f, t);
+
+    if (sphere != NoSphere)
+    {
+        closest.t = T(t);
+        closest.primitive = sphere;
+    }
+
+    if (scene.m_RelativeCheckerboard.RayIntersect(relative, d, t) && T(t) < closest.t)
+    {
+        closest.t = T(t);
+        closest.primitive = PlanePrimitive;
+    }
+
+    return closest.t < 1000;
+}
+
+// Mixed precision: the sphere hit is solved again in double, starting from
+// the float estimate, and the point and normal are built in double. Far from
+// the origin "xa * xa" and "r * r" differ by many orders of magnitude and
+// float cancellation misplaces the hit; the point, and the origins of the
+// rays leaving it, stay in T (double in mixed mode) so the offsets that keep
+// them off the surface are not swamped by rounding.
+//
+template <typename T> void RefineSphereHit(const vec<3, T>& origin, const vec<3, T>& direction, const SphereT<T>& sphere, T t, HitT<T>& hitInfo)
+{
+    Vec3d d = Vec3d(direction);
+    Vec3d center = Vec3d(sphere.m_Center);
+    Vec3d point = Vec3d(origin) + d * double(t);
+    Vec3d xa = point - center;
 
-            hitInfo.point = origin + direction * t;
-            hitInfo.normal = (hitInfo.point - spheres[i].m_Center).normalize();
-            hitInfo.material = spheres[i].m_Material;
+    double a = d * d;
+    double b = xa * d;
+    double delta = (b * b) - a * ((xa * xa) - double(sphere.m_Radius) * double(sphere.m_Radius));
+
+    if (delta >= 0)
+    {
+        // Of the two roots, the correction closest to the estimate.
+        double s1 = (- b - std::sqrt(delta)) / a;
+        double s2 = (- b + std::sqrt(delta)) / a;
+
+        point = point + d * (std::fabs(s1) < std::fabs(s2) ? s1 : s2);
+    }
+
+    hitInfo.point = vec<3, T>(point);
+    hitInfo.normal = vec<3, T>((point - center).normalize());
+}
+
+// The checker pattern is looked up at a position rounded to the precision of
+// the scene coordinates, which far from the origin moves the square edges.
+//
+template <typename T> Vec3f RefinePlaneColor(const vec<3, T>& origin, const vec<3, T>& direction, const CheckerboardT<T>& checkerboard)
+{
+    Vec3d relative = Vec3d(origin) - Vec3d(checkerboard.m_Offset);
+    double d = - (relative.y + 4.0) / double(direction.y);
+
+    return CheckerboardT<double>().Color(relative + Vec3d(direction) * d);
+}
+
+template <typename T> void FinalizeHit(const vec<3, T>& origin, const vec<3, T>& direction, const SceneT<T>& scene, const ClosestHitT<T>& closest, HitT<T>& hitInfo, bool refine = false)
+{
+    if (closest.primitive == PlanePrimitive)
+    {
+        hitInfo.point = origin + direction * closest.t;
+        hitInfo.normal = vec<3, T>(0, 1, 0);
+        hitInfo.material = Material();
+        hitInfo.material.m_DiffuseColor = (refine ? RefinePlaneColor(origin, direction, scene.m_Checkerboard) : scene.m_Checkerboard.Color(hitInfo.point)) * 0.3f;
+    }
+    else
+    {
+        const SphereT<T>& sphere = scene.m_Spheres[closest.primitive];
+
+        if (refine) RefineSphereHit(origin, direction, sphere, closest.t, hitInfo);
+        else
+        {
+            hitInfo.point = origin + direction * closest.t;
+            hitInfo.normal = (hitInfo.point - sphere.m_Center).normalize();
         }
+
+        hitInfo.material = sphere.m_Material;
     }
+}
 
-    
-    if (fabs(direction.y) > 1e-3) // Drawning a plane (board).
+template <typename T> bool SceneIntersect(const vec<3, T>& origin, const vec<3, T>& direction, const SceneT<T>& scene, HitT<T>& hitInfo, ThreadContext& context)
+{
+    ClosestHitT<T> closest;
+
+    if (!(context.m_RefineHits ? SceneIntersectClosestRelative(origin, direction, scene, closest, context.m_Stats)
+                               : SceneIntersectClosest(origin, direction, scene, closest, context.m_Stats))) return false;
+
+    FinalizeHit(origin, direction, scene, closest, hitInfo, context.m_RefineHits);
+
+    return true;
+}
+
+const Vec3f BackgroundColor = Vec3f(0.2, 0.5, 0.8);
+
+// Peventing intersection with the hitted point. Far from the origin 1e-3 is
+// below the spacing of representable values, so the offset also grows with
+// the magnitude of the point (a few ulps).
+//
+template <typename T> vec<3, T> OffsetOrigin(const vec<3, T>& point, const vec<3, T>& normal, const vec<3, T>& direction)
+{
+    T magnitude = std::max(std::fabs(point.x), std::max(std::fabs(point.y), std::fabs(point.z)));
+    T epsilon = std::max(T(1e-3), magnitude * std::numeric_limits<T>::epsilon() * 8);
+
+    return direction * normal < 0 ? point - normal * epsilon : point + normal * epsilon;
+}
+
+// Distance along "direction" to the surface of a spherical light, or a
+// negative value if the ray misses it.
+//
+template <typename T> T LightDistance(const vec<3, T>& origin, const vec<3, T>& direction, const Light& light)
+{
+    vec<3, T> oc = origin - vec<3, T>(light.m_Position);
+    T b = oc * direction;
+    T delta = (b * b) - (oc * oc) + (light.m_Radius * light.m_Radius);
+
+    if (delta < 0) return -1.0f;
+
+    return - b - std::sqrt(delta);
+}
+
+template <typename T> bool LightVisible(const HitT<T>& hitInfo, const vec<3, T>& lightDirection, T lightDistance,
+                                        const SceneT<T>& scene, ThreadContext& context)
+{
+    ClosestHitT<T> shaddowInfo;
+    vec<3, T> shadowOrigin = OffsetOrigin(hitInfo.point, hitInfo.normal, lightDirection);
+
+    context.m_Stats.m_ShadowRays++;
+
+    const bool hit = context.m_RefineHits ? SceneIntersectClosestRelative(shadowOrigin, lightDirection, scene, shaddowInfo, context.m_Stats)
+                                          : SceneIntersectClosest(shadowOrigin, lightDirection, scene, shaddowInfo, context.m_Stats);
+
+    return !(hit && shaddowInfo.t < lightDistance);
+}
+
+// Any-hit query: is anything closer than "maxDistance" along the ray? It stops
+// at the first primitive found, and spheres out of reach of the ray are
+// skipped before their quadratic is solved, so short rays are cheap.
+//
+template <typename T> bool SceneOccluded(const vec<3, T>& origin, const vec<3, T>& direction, T maxDistance, const SceneT<T>& scene, RenderStats& stats)
+{
+    const std::vector<SphereT<T> >& spheres = scene.m_Spheres;
+    T t;
+
+    stats.m_IntersectionTests++;
+
+    if (scene.m_Checkerboard.RayIntersect(origin, direction, t) && t < maxDistance) return true;
+
+    for (size_t i = 0; i < spheres.size(); i++)
+    {
+        vec<3, T> toCenter = spheres[i].m_Center - origin;
+        T reach = maxDistance + spheres[i].m_Radius;
+
+        if (toCenter * toCenter > reach * reach) continue;
+
+        stats.m_IntersectionTests++;
+
+        if (spheres[i].RayIntersect(origin, direction, t) && t < maxDistance) return true;
+    }
+
+    return false;
+}
+
+// Spherical light. Its intensity is spread evenly over the solid angle it
+// covers, so that a vanishing radius gives the point light result. Diffuse
+// uses light samples only; the glossy lobe also draws lobe samples and both
+// strategies are combined with multiple importance sampling, which keeps
+// high exponents (mirror: 1425) from turning into fireflies.
+//
+template <typename T> void ShadeAreaLight(const HitT<T>& hitInfo, const vec<3, T>& direction, const Light& light,
+                                          const SceneT<T>& scene, ThreadContext& context,
+                                          float& diffuseLightIntensity, float& specularLightIntensity)
+{
+    vec<3, T> toLightT = vec<3, T>(light.m_Position) - hitInfo.point;
+    float centerDistance = float(toLightT.norm());
+
+    if (centerDistance <= light.m_Radius) return; // Inside the light.
+
+    Vec3f toLight = Vec3f(toLightT) * (1.0f / centerDistance);
+    Vec3f normal = Vec3f(hitInfo.normal);
+
+    float sinThetaMax = light.m_Radius / centerDistance;
+    float cosThetaMax = sqrtf(std::max(0.0f, 1.0f - sinThetaMax * sinThetaMax));
+    float lightPdf = 1.0f / ConeSolidAngle(cosThetaMax);
+
+    const float exponent = hitInfo.material.m_SpecularExponent;
+    const bool glossy = hitInfo.material.m_Albedo[1] != 0.0f;
+    const MisHeuristic heuristic = context.m_Heuristic;
+    const int samples = context.m_LightSamples;
+
+    Vec3f mirror = Vec3f(Reflect(direction, hitInfo.normal).normalize());
+    float diffuseSum = 0.0f, specularSum = 0.0f;
+
+    for (int s = 0; s < samples; s++)
     {
-        float d = - (origin.y + 4.0f) / direction.y; // The checkerboard plane has equation "y = -4".
-        Vec3f p = origin + direction * d;
+        // Light sample.
+        float u1 = context.m_Random.NextFloat(), u2 = context.m_Random.NextFloat();
+        Vec3f lightDirection = SampleCone(toLight, cosThetaMax, u1, u2);
+        T lightDistance = LightDistance(hitInfo.point, vec<3, T>(lightDirection), light);
+
+        if (lightDistance > 0 && LightVisible(hitInfo, vec<3, T>(lightDirection), lightDistance, scene, context))
+        {
+            diffuseSum += light.m_Intensity * std::max(0.0f, lightDirection * normal);
 
-        if (d > 0 && fabs(p.x) < 10 && p.z < -10 && p.z > -30 && d < spheresDistance)
+            if (glossy && heuristic != MisLobeOnly)
+            {
+                float cosAlpha = std::max(0.0f, lightDirection * mirror);
+                float weight = heuristic == MisLightOnly ? 1.0f : MisWeight(lightPdf, PhongLobePdf(cosAlpha, exponent), heuristic);
+
+                specularSum += weight * light.m_Intensity * powf(cosAlpha, exponent);
+            }
+        }
+
+        // Lobe sample: the Phong lobe divided by its pdf is the constant 2 pi / (n + 1).
+        if (glossy && heuristic != MisLightOnly)
         {
-            Vec3f c = (int(0.5f * p.x + 1000) + int(0.5f * p.z)) & 1 ? Vec3f(1.0f, 1.0f, 1.0f) : Vec3f(1.0f, 0.7f, 0.3f);
+            u1 = context.m_Random.NextFloat(), u2 = context.m_Random.NextFloat();
+            Vec3f lobeDirection = SamplePhongLobe(mirror, exponent, u1, u2);
+
+            if (lobeDirection * toLight < cosThetaMax) continue;
 
-            checkerboardDistance = d;
+            lightDistance = LightDistance(hitInfo.point, vec<3, T>(lobeDirection), light);
 
-            hitInfo.point = p;
-            hitInfo.normal = Vec3f(0, 1, 0);
+            if (lightDistance > 0 && LightVisible(hitInfo, vec<3, T>(lobeDirection), lightDistance, scene, context))
+            {
+                float lobePdf = PhongLobePdf(std::max(0.0f, lobeDirection * mirror), exponent);
+                float weight = heuristic == MisLobeOnly ? 1.0f : MisWeight(lobePdf, lightPdf, heuristic);
 
-            hitInfo.material.m_DiffuseColor = c * 0.3f;
+                specularSum += weight * light.m_Intensity * lightPdf * 2.0f * Pi / (exponent + 1.0f);
+            }
         }
     }
 
-    return std::min(spheresDistance, checkerboardDistance) < 1000; // Why "1000" here?
+    diffuseLightIntensity += diffuseSum / samples;
+    specularLightIntensity += specularSum / samples;
 }
 
-Vec3f CastRay(const Vec3f& origin, const Vec3f& direction,
-              const std::vector<Sphere>& spheres, const std::vector<Light>& lights,
-              size_t depth = 0)
+// Shadow rays toward the lights of "candidates"; returns the lanes that reach their light.
+template <typename T> int ShadowMask(const HitT<T>& hitInfo, const LightLanes& lanes, const float* radius, int candidates,
+                                     const SceneT<T>& scene, ThreadContext& context)
 {
-    Hit hitInfo = Hit();
-    float diffuseLightIntensity = 0.0f, specularLightIntensity = 0.0f;
+    int lit = 0;
+
+    for (int i = 0; i < BatchSize; i++) {
+        if (!(candidates & (1 << i))) continue;
+
+        vec<3, T> lightDirection(lanes.m_X[i], lanes.m_Y[i], lanes.m_Z[i]);
+
+        if (LightVisible(hitInfo, lightDirection, T(lanes.m_Distance[i] - radius[i]), scene, context)) lit |= 1 << i;
+    }
+
+    return lit;
+}
+
+// Point lights are shaded a block of BatchSize at a time; area lights are
+// sampled one by one.
+//
+template <typename T> void ShadeLights(const HitT<T>& hitInfo, const vec<3, T>& direction,
+                                       const SceneT<T>& scene, const LightSet& lights,
+                                       ThreadContext& context, float& diffuseLightIntensity, float& specularLightIntensity)
+{
+    LightLanes lanes;
 
-    if (depth < 5 && SceneIntersect(origin, direction, spheres, hitInfo))
+    for (int block = 0; block < lights.m_Blocks; block++)
     {
-        Vec3f reflectDirection = Reflect(direction, hitInfo.normal).normalize();
-        Vec3f reflectOrigin = reflectDirection * hitInfo.normal < 0 ? hitInfo.point - hitInfo.normal * 1e-3 : hitInfo.point + hitInfo.normal * 1e-3; // Peventing intersection with the hitted point.
-        Vec3f reflectColor = CastRay(reflectOrigin, reflectDirection, spheres, lights, depth + 1);
+        const float* intensity = &lights.m_Intensity[block * BatchSize];
+        const float* radius = &lights.m_Radius[block * BatchSize];
+        int pointLights = 0;
+
+        for (int i = 0; i < BatchSize; i++) pointLights |= (radius[i] == 0.0f) << i;
+
+        ComputeLightLanes(lights, block, hitInfo.point, hitInfo.normal, direction, lanes);
+
+        int candidates = lights.ValidMask(block) & pointLights & ContributingMask(lanes);
+        int lit = ShadowMask(hitInfo, lanes, radius, candidates, scene, context);
 
-        Vec3f refractDirection = Refract(direction, hitInfo.normal, hitInfo.material.m_RefractiveIndex).normalize();
-        Vec3f refractOrigin = refractDirection * hitInfo.normal < 0 ? hitInfo.point - hitInfo.normal * 1e-3 : hitInfo.point + hitInfo.normal * 1e-3; // Peventing intersection with the hitted point.
-        Vec3f refractColor = CastRay(refractOrigin, refractDirection, spheres, lights, depth + 1);
+        for (int i = 0; i < BatchSize; i++) {
+            if (!(lit & (1 << i))) continue;
 
-        for (size_t i = 0; i < lights.size(); i++)
+            diffuseLightIntensity += intensity[i] * std::max(0.0f, lanes.m_Diffuse[i]);
+            specularLightIntensity += intensity[i] * powf(std::max(0.0f, lanes.m_Specular[i]), hitInfo.material.m_SpecularExponent);
+        }
+    }
+
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        if (lights.m_Lights[i].m_Radius > 0)
         {
-            Hit shaddowInfo = Hit();
+            ShadeAreaLight(hitInfo, direction, lights.m_Lights[i], scene, context, diffuseLightIntensity, specularLightIntensity);
+        }
+    }
+}
+
+template <typename T> Vec3f ShadeHit(const HitT<T>& hitInfo, const Vec3f& reflectColor, const Vec3f& refractColor, float diffuseLightIntensity, float specularLightIntensity)
+{
+    Vec3f diffuseComp = hitInfo.material.m_DiffuseColor * hitInfo.material.m_Albedo[0] * diffuseLightIntensity;
+    Vec3f specularComp = Vec3f(1.0f, 1.0f, 1.0f) * hitInfo.material.m_Albedo[1] * specularLightIntensity;
+
+    Vec3f reflectComp = reflectColor * hitInfo.material.m_Albedo[2];
+    Vec3f refractComp = refractColor * hitInfo.material.m_Albedo[3];
+
+    return diffuseComp + specularComp + reflectComp + refractComp;
+}
+
+// GGX shading (see libs/Microfacet.h), one block of lights at a time; lights
+// in shadow get a zero intensity lane. Area lights are treated as points at
+// their center here.
+//
+template <typename T> Vec3f ShadeMicrofacet(const HitT<T>& hitInfo, const vec<3, T>& direction, const Vec3f& reflectColor, const Vec3f& refractColor,
+                                            const SceneT<T>& scene, const LightSet& lights, ThreadContext& context)
+{
+    const Material& material = hitInfo.material;
+
+    float reflectance = (material.m_RefractiveIndex - 1.0f) / (material.m_RefractiveIndex + 1.0f);
+    Vec3f f0 = material.m_Model == ConductorModel ? material.m_DiffuseColor : Vec3f(1.0f, 1.0f, 1.0f) * (reflectance * reflectance);
+
+    MicrofacetSurface surface(Vec3f(hitInfo.normal), Vec3f(direction), material.m_Roughness, f0);
 
-            Vec3f lightDirection = (lights[i].m_Position - hitInfo.point).normalize();
-            float lightDistance = (lights[i].m_Position - hitInfo.point).norm();
-            Vec3f shadowOrigin = lightDirection * hitInfo.normal < 0 ? hitInfo.point - hitInfo.normal * 1e-3 : hitInfo.point + hitInfo.normal * 1e-3; // Peventing intersection with the hitted point.
+    LightLanes lanes;
+    alignas(32) float intensity[BatchSize];
+    float sumA = 0.0f, sumB = 0.0f, diffuseLightIntensity = 0.0f;
 
-            if (SceneIntersect(shadowOrigin, lightDirection, spheres, shaddowInfo) && (shaddowInfo.point - shadowOrigin).norm() < lightDistance)
-                continue;
+    for (int block = 0; block < lights.m_Blocks; block++)
+    {
+        ComputeLightLanes(lights, block, hitInfo.point, hitInfo.normal, direction, lanes);
+
+        int candidates = 0;
+
+        for (int i = 0; i < BatchSize; i++) candidates |= (lanes.m_Diffuse[i] > 0.0f) << i;
+
+        const float* radius = &lights.m_Radius[block * BatchSize];
+        int lit = ShadowMask(hitInfo, lanes, radius, candidates & lights.ValidMask(block), scene, context);
+
+        for (int i = 0; i < BatchSize; i++) intensity[i] = lit & (1 << i) ? lights.m_Intensity[block * BatchSize + i] : 0.0f;
+
+        EvaluateGgxLights(surface, lanes.m_X, lanes.m_Y, lanes.m_Z, intensity, BatchSize, sumA, sumB, diffuseLightIntensity);
+    }
+
+    Vec3f color;
 
-            Vec3f reflectedLight = Reflect(lightDirection, hitInfo.normal);
+    for (size_t c = 0; c < 3; c++) {
+        float specular = (f0[c] * sumA + sumB) * surface.m_EnergyCompensation[c];
+        float albedo = surface.m_DirectionalAlbedo[c];
 
-            // We can use a simplified formula, like:
-            //
-            // DF = Light Direction * Normal
-            //
-            float diffuseFactor = (lightDirection * hitInfo.normal) / (lightDirection.norm() * hitInfo.normal.norm());
+        color[c] = specular * material.m_Albedo[1] + reflectColor[c] * albedo * material.m_Albedo[2];
 
-            diffuseLightIntensity += lights[i].m_Intensity * std::max(0.0f, diffuseFactor);
-            specularLightIntensity += lights[i].m_Intensity * powf(std::max(0.0f, reflectedLight * direction), hitInfo.material.m_SpecularExponent);
+        // What the coating does not reflect reaches the diffuse base or is refracted.
+        if (material.m_Model == DielectricModel)
+        {
+            color[c] += (material.m_DiffuseColor[c] * diffuseLightIntensity * material.m_Albedo[0] + refractColor[c] * material.m_Albedo[3]) * (1.0f - albedo);
         }
+    }
+
+    return color;
+}
+
+template <typename T> Vec3f Shade(const HitT<T>& hitInfo, const vec<3, T>& direction, const Vec3f& reflectColor, const Vec3f& refractColor,
+                                  const SceneT<T>& scene, const LightSet& lights, ThreadContext& context)
+{
+    if (hitInfo.material.m_Model != PhongModel) return ShadeMicrofacet(hitInfo, direction, reflectColor, refractColor, scene, lights, context);
+
+    float diffuseLightIntensity = 0.0f, specularLightIntensity = 0.0f;
 
-        Vec3f diffuseComp = hitInfo.material.m_DiffuseColor * hitInfo.material.m_Albedo[0] * diffuseLightIntensity;
-        Vec3f specularComp = Vec3f(1.0f, 1.0f, 1.0f) * hitInfo.material.m_Albedo[1] * specularLightIntensity;
+    ShadeLights(hitInfo, direction, scene, lights, context, diffuseLightIntensity, specularLightIntensity);
 
-        Vec3f reflectComp = reflectColor * hitInfo.material.m_Albedo[2];
-        Vec3f refractComp = refractColor * hitInfo.material.m_Albedo[3];
+    return ShadeHit(hitInfo, reflectColor, refractColor, diffuseLightIntensity, specularLightIntensity);
+}
+
+template <typename T> void RecordGuide(const vec<3, T>& origin, const HitT<T>& hitInfo, PixelGuide& guide)
+{
+    guide.m_Depth = float((hitInfo.point - origin).norm());
+    guide.m_Normal = Vec3f(hitInfo.normal);
+    guide.m_Material = hitInfo.material.Id();
+}
+
+template <typename T> Vec3f CastRay(const vec<3, T>& origin, const vec<3, T>& direction,
+                                    const SceneT<T>& scene, const LightSet& lights,
+                                    ThreadContext& context, size_t depth = 0)
+{
+    HitT<T> hitInfo = HitT<T>();
+
+    if (depth == 0) context.m_Stats.m_PrimaryRays++;
+    else context.m_Stats.m_SecondaryRays++;
+
+    if ((int)depth < context.m_MaxDepth && SceneIntersect(origin, direction, scene, hitInfo, context))
+    {
+        if (depth == 0 && context.m_Guide) RecordGuide(origin, hitInfo, *context.m_Guide);
+
+        vec<3, T> reflectDirection = Reflect(direction, hitInfo.normal).normalize();
+        vec<3, T> reflectOrigin = OffsetOrigin(hitInfo.point, hitInfo.normal, reflectDirection);
+        Vec3f reflectColor = CastRay(reflectOrigin, reflectDirection, scene, lights, context, depth + 1);
 
-        return diffuseComp + specularComp + reflectComp + refractComp;
+        vec<3, T> refractDirection = Refract(direction, hitInfo.normal, hitInfo.material.m_RefractiveIndex).normalize();
+        vec<3, T> refractOrigin = OffsetOrigin(hitInfo.point, hitInfo.normal, refractDirection);
+        Vec3f refractColor = CastRay(refractOrigin, refractDirection, scene, lights, context, depth + 1);
+
+        return Shade(hitInfo, direction, reflectColor, refractColor, scene, lights, context);
     }
     
-    return Vec3f(0.2, 0.5, 0.8); // Background color.
+    return BackgroundColor;
 }
 
-void Render(const std::vector<Sphere>& spheres, const std::vector<Light>& lights)
+// Batched version of CastRay: "mask" selects the live lanes of the batch.
+// Reflection and refraction directions are computed for all lanes at once,
+// and only lanes that hit something (and, for refraction, do not undergo
+// total internal reflection) are traced further. Lanes with zero reflect or
+// refract albedo are masked out too, as their color would be discarded.
+//
+void CastRayBatch(const Vec3Batch& origins, const Vec3Batch& directions, int mask,
+                  const Scene& scene, const LightSet& lights,
+                  ThreadContext& context, Vec3f* colors, size_t depth = 0)
 {
-    const int fov    = M_PI / 2.0;
-    const int width  = 1024;
-    const int height = 768;
+    for (int i = 0; i < BatchSize; i++) colors[i] = BackgroundColor;
 
-    std::vector<Vec3f> framebuffer(width * height);
+    if ((int)depth >= context.m_MaxDepth || !mask) return;
 
-    #pragma omp parallel for
-    for (size_t j = 0; j < height; j++) {
-        for (size_t i = 0; i < width; i++) {
-            float x =  (2 * (i + 0.5) / (float)width  - 1) * tan(fov / 2.0) * width / (float)height;
-            float y = -(2 * (j + 0.5) / (float)height - 1) * tan(fov / 2.0);
+    Hit hits[BatchSize];
+    Vec3Batch normals;
+    float refractiveIndices[BatchSize];
+    int hitMask = 0;
 
-            Vec3f viewDirection = Vec3f(x, y, -1).normalize();
+    for (int i = 0; i < BatchSize; i++) {
+        if (mask & (1 << i))
+        {
+            if (depth == 0) context.m_Stats.m_PrimaryRays++;
+            else context.m_Stats.m_SecondaryRays++;
 
-            framebuffer[i + j * width] = CastRay(Vec3f(0, 0, 0), viewDirection, spheres, lights);
+            if (SceneIntersect(origins.Get(i), directions.Get(i), scene, hits[i], context)) hitMask |= 1 << i;
         }
+
+        normals.Set(i, hits[i].normal);
+        refractiveIndices[i] = hitMask & (1 << i) ? hits[i].material.m_RefractiveIndex : 1.0f;
     }
 
-    std::ofstream ofs;
-    ofs.open("outputs/image.ppm", std::ofstream::out | std::ofstream::binary);
+    if (!hitMask) return;
+
+    Vec3Batch reflectDirections, refractDirections;
+    Vec3Batch reflectOrigins, refractOrigins;
+
+    ReflectBatch(directions, normals, reflectDirections);
+    NormalizeBatch(reflectDirections);
+
+    int totalInternalReflection = RefractBatch(directions, normals, refractiveIndices, refractDirections);
+    NormalizeBatch(refractDirections);
+
+    int reflectMask = 0, refractMask = 0;
+
+    for (int i = 0; i < BatchSize; i++) {
+        reflectOrigins.Set(i, OffsetOrigin(hits[i].point, hits[i].normal, reflectDirections.Get(i)));
+        refractOrigins.Set(i, OffsetOrigin(hits[i].point, hits[i].normal, refractDirections.Get(i)));
+
+        if (hits[i].material.m_Albedo[2] != 0.0f) reflectMask |= 1 << i;
+        if (hits[i].material.m_Albedo[3] != 0.0f) refractMask |= 1 << i;
+    }
+
+    Vec3f reflectColors[BatchSize], refractColors[BatchSize];
+
+    // Lanes under total internal reflection keep the background color, like
+    // the scalar path, whose NaN refraction direction misses the whole scene.
+    CastRayBatch(reflectOrigins, reflectDirections, hitMask & reflectMask, scene, lights, context, reflectColors, depth + 1);
+    CastRayBatch(refractOrigins, refractDirections, hitMask & refractMask & ~totalInternalReflection, scene, lights, context, refractColors, depth + 1);
+
+    for (int i = 0; i < BatchSize; i++) {
+        if (!(hitMask & (1 << i))) continue;
+
+        colors[i] = Shade(hits[i], directions.Get(i), reflectColors[i], refractColors[i], scene, lights, context);
+    }
+}
+
+// Ambient occlusion of the primary hit, in gray: the share of "table"'s
+// cosine-distributed rays that travel "distance" without hitting anything.
+// The pixel's generator picks a set of the table and turns it about the
+// normal. Occlusion rays are counted as shadow rays.
+//
+template <typename T> Vec3f CastOcclusionRay(const vec<3, T>& origin, const vec<3, T>& direction, const SceneT<T>& scene,
+                                             const CosineTable& table, T distance, ThreadContext& context)
+{
+    HitT<T> hitInfo = HitT<T>();
+
+    context.m_Stats.m_PrimaryRays++;
+
+    if (!SceneIntersect(origin, direction, scene, hitInfo, context)) return BackgroundColor;
+
+    if (context.m_Guide) RecordGuide(origin, hitInfo, *context.m_Guide);
+
+    Vec3f normal = Vec3f(direction * hitInfo.normal > 0 ? -hitInfo.normal : hitInfo.normal);
+    Vec3f tangent, bitangent;
+    OrthonormalBasis(normal, tangent, bitangent);
+
+    const int set = int(context.m_Random.NextUInt() % table.Sets());
+    const float angle = 2.0f * Pi * context.m_Random.NextFloat();
+    const float cosine = std::cos(angle), sine = std::sin(angle);
+    int open = 0;
+
+    for (int k = 0; k < table.m_Count; k++) {
+        vec<3, T> occlusionDirection = vec<3, T>(table.Direction(set, k, cosine, sine, tangent, bitangent, normal));
+        vec<3, T> occlusionOrigin = OffsetOrigin(hitInfo.point, vec<3, T>(normal), occlusionDirection);
+
+        context.m_Stats.m_ShadowRays++;
+
+        if (!SceneOccluded(occlusionOrigin, occlusionDirection, distance, scene, context.m_Stats)) open++;
+    }
+
+    return Vec3f(1.0f, 1.0f, 1.0f) * (float(open) / table.m_Count);
+}
+
+// Tangent of half the field of view. "fov" is truncated to 1 radian; every
+// image so far was rendered with it, so it stays.
+inline double HalfFovTangent()
+{
+    const int fov = M_PI / 2.0;
+
+    return tan(fov / 2.0);
+}
+
+// (dx, dy) is the sample position inside the pixel, the center by default.
+template <typename T> vec<3, T> PrimaryDirection(int i, int j, int width, int height, double dx = 0.5, double dy = 0.5)
+{
+    T x =  (2 * (i + dx) / (float)width  - 1) * HalfFovTangent() * width / (float)height;
+    T y = -(2 * (j + dy) / (float)height - 1) * HalfFovTangent();
+
+    return vec<3, T>(x, y, -1).normalize();
+}
 
-    ofs << "P6\n" << width << " " << height << "\n255\n";
+// Every pixel sample reseeds the thread's generator from its coordinates, so
+// the image does not depend on which thread rendered which tile. With a single
+// sample the ray goes through the pixel center, otherwise it is jittered.
+//
+template <typename T> vec<3, T> SamplePrimaryDirection(int i, int j, int sample, int samplesPerPixel, const Framebuffer& framebuffer, ThreadContext& context)
+{
+    context.m_Random = Random(HashSeed(i, j, sample));
+
+    if (samplesPerPixel == 1) return PrimaryDirection<T>(i, j, framebuffer.m_Width, framebuffer.m_Height);
+
+    double dx = context.m_Random.NextFloat(), dy = context.m_Random.NextFloat();
+
+    return PrimaryDirection<T>(i, j, framebuffer.m_Width, framebuffer.m_Height, dx, dy);
+}
+
+// Samples [first, last) of the tile's pixels, each traced by "integrate" from
+// its primary direction. With an importance map, a pixel traces only the
+// first of them its rate allows, with its own light samples and a depth
+// drawn per sample, and the last pass divides by its own sample count. With a
+// guide buffer, the first sample records the primary hit there.
+//
+template <typename T, typename Integrate> void RenderPixels(int samplesPerPixel, const Tile& tile, Framebuffer& framebuffer, ThreadContext& context, Integrate integrate)
+{
+    const int first = context.m_FirstSample, last = context.m_LastSample;
+    const bool lastPass = last == samplesPerPixel;
+
+    for (int j = tile.m_Y0; j < tile.m_Y1; j++) {
+        for (int i = tile.m_X0; i < tile.m_X1; i++) {
+            if (context.m_Region && !context.m_Region->Contains(i, j)) continue;
+
+            ShadingRate rate = { samplesPerPixel, context.m_LightSamples, context.m_MaxDepth, 0.0f };
+
+            if (context.m_Importance)
+            {
+                rate = context.m_Importance->Rate(i, j);
+                context.m_LightSamples = rate.m_LightSamples;
+            }
+
+            Vec3f color = first > 0 ? framebuffer(i, j) : Vec3f();
+
+            if (context.m_Guides && first == 0) (*context.m_Guides)(i, j) = PixelGuide();
+
+            const RenderStats before = context.m_Stats;
+            const uint64_t start = context.m_Costs ? ReadCycleCounter() : 0;
+
+            for (int s = first; s < std::min(last, rate.m_Samples); s++) {
+                vec<3, T> viewDirection = SamplePrimaryDirection<T>(i, j, s, rate.m_Samples, framebuffer, context);
+
+                if (context.m_Importance) context.m_MaxDepth = rate.m_Depth + (context.m_Random.NextFloat() < rate.m_DepthFraction ? 1 : 0);
+
+                context.m_Guide = context.m_Guides && s == 0 ? &(*context.m_Guides)(i, j) : NULL;
 
-    for (size_t i = 0; i < width * height; i++) {
-        // There is no need of the code below.
-        // It would only be in case of color overflow.
-        //
-        // Vec3f &color = framebuffer[i];
-        // float max = std::max(color[0], std::max(color[1], color[2]));
-        //
-        // if (max > 1) color = color * (1.0f / max);
+                color = color + integrate(viewDirection);
+            }
 
-        for (size_t j = 0; j < 3; j++) {
-            ofs << (char)(255 * std::max(0.0f, std::min(1.0f, framebuffer[i][j])));
+            if (context.m_Costs) context.m_Costs->Record(i, j, before, context.m_Stats, ReadCycleCounter() - start);
+
+            framebuffer(i, j) = lastPass && rate.m_Samples > 1 ? color * (1.0f / rate.m_Samples) : color;
         }
     }
+}
 
-    ofs.close();
+template <typename T> void RenderTile(const SceneT<T>& scene, const LightSet& lights, int samplesPerPixel,
+                                      const Tile& tile, Framebuffer& framebuffer, ThreadContext& context)
+{
+    RenderPixels<T>(samplesPerPixel, tile, framebuffer, context, [&](const vec<3, T>& direction) {
+        return CastRay(scene.m_Eye, direction, scene, lights, context);
+    });
+}
+
+// The occlusion directions are drawn once per tile, from its position, so the
+// image does not depend on the schedule either. Eight sets give neighbouring
+// pixels different strata.
+//
+template <typename T> void RenderTileOcclusion(const SceneT<T>& scene, int samplesPerPixel, int occlusionSamples, float distance,
+                                               const Tile& tile, Framebuffer& framebuffer, ThreadContext& context)
+{
+    CosineTable table;
+    Random random(HashSeed(tile.m_X0, tile.m_Y0, 0), 1);
+
+    table.Build(occlusionSamples, 8, random);
+
+    RenderPixels<T>(samplesPerPixel, tile, framebuffer, context, [&](const vec<3, T>& direction) {
+        return CastOcclusionRay(scene.m_Eye, direction, scene, table, T(distance), context);
+    });
+}
+
+// Packets only exist in float; other precisions trace one ray at a time.
+template <typename T> void RenderTileBatched(const SceneT<T>& scene, const LightSet& lights, int samplesPerPixel,
+                                             const Tile& tile, Framebuffer& framebuffer, ThreadContext& context)
+{
+    RenderTile(scene, lights, samplesPerPixel, tile, framebuffer, context);
+}
+
+void RenderTileBatched(const Scene& scene, const LightSet& lights, int samplesPerPixel,
+                       const Tile& tile, Framebuffer& framebuffer, ThreadContext& context)
+{
+    Vec3Batch origins, directions;
+    Vec3f colors[BatchSize];
+
+    const int first = context.m_FirstSample, last = context.m_LastSample;
+    const bool normalize = samplesPerPixel > 1 && last == samplesPerPixel;
+
+    for (int i = 0; i < BatchSize; i++) origins.Set(i, scene.m_Eye);
+
+    for (int j = tile.m_Y0; j < tile.m_Y1; j++) {
+        for (int i = tile.m_X0; i < tile.m_X1; i += BatchSize) {
+            int mask = 0, lanes = 0;
+            Vec3f sums[BatchSize];
+
+            for (int k = 0; k < BatchSize; k++) {
+                if (i + k < tile.m_X1 && (!context.m_Region || context.m_Region->Contains(i + k, j)))
+                {
+                    mask |= 1 << k;
+                    lanes++;
+
+                    if (first > 0) sums[k] = framebuffer(i + k, j);
+                }
+            }
+
+            if (!mask) continue;
+
+            const RenderStats before = context.m_Stats;
+            const uint64_t start = context.m_Costs ? ReadCycleCounter() : 0;
+
+            for (int s = first; s < last; s++) {
+                // Lanes draw their jitter in order; the generator left afterwards
+                // serves the whole packet, as shading interleaves the lanes.
+                for (int k = 0; k < BatchSize; k++) {
+                    directions.Set(k, SamplePrimaryDirection<float>(std::min(i + k, tile.m_X1 - 1), j, s, samplesPerPixel, framebuffer, context));
+                }
+
+                CastRayBatch(origins, directions, mask, scene, lights, context, colors);
+
+                for (int k = 0; k < BatchSize; k++) sums[k] = sums[k] + colors[k];
+            }
+
+            // Lanes share the shading of the packet, so its cost is split evenly.
+            const uint64_t cycles = context.m_Costs ? ReadCycleCounter() - start : 0;
+
+            for (int k = 0; k < BatchSize && i + k < tile.m_X1; k++) {
+                if (!(mask & (1 << k))) continue;
+
+                if (context.m_Costs) context.m_Costs->Record(i + k, j, before, context.m_Stats, cycles, lanes);
+
+                framebuffer(i + k, j) = normalize ? sums[k] * (1.0f / samplesPerPixel) : sums[k];
+            }
+        }
+    }
+}
+
+// Tiles are handed out dynamically, but their edges fall on cache line
+// boundaries of the framebuffer, so threads never write to the same line.
+// With a region, only the tiles overlapping it are scheduled. With a shared
+// framebuffer, each tile is flagged there as soon as it is done.
+//
+template <typename T> void RenderScene(const SceneT<T>& scene, const Options& options, Framebuffer& framebuffer, ThreadContexts& contexts,
+                                       CostMap* costs, const RenderRegion* region, SharedFramebuffer* shared, const ImportanceMap* importance,
+                                       GuideBuffer* guides, int firstSample, int lastSample)
+{
+    const std::vector<Tile> tiles = region ? framebuffer.Tiles(region->m_Bounds) : framebuffer.Tiles();
+    const int tileCount = (int)tiles.size();
+    TraceScope trace("render");
+
+    const LightSet lightSet(scene.m_Lights);
+
+    contexts.resize(ThreadCount());
+
+    for (size_t i = 0; i < contexts.size(); i++) {
+        contexts[i].m_LightSamples = options.m_LightSamples;
+        contexts[i].m_Heuristic = options.m_Heuristic;
+        contexts[i].m_RefineHits = options.m_Precision == MixedPrecision;
+        contexts[i].m_Costs = costs;
+        contexts[i].m_Region = region;
+        contexts[i].m_FirstSample = firstSample;
+        contexts[i].m_LastSample = lastSample;
+        contexts[i].m_MaxDepth = 5;
+        contexts[i].m_Importance = importance;
+        contexts[i].m_Guides = guides;
+        contexts[i].m_Guide = NULL;
+    }
+
+    // Each thread counts hardware events around its share of the tiles.
+    #pragma omp parallel
+    {
+        ThreadContext& context = contexts[ThreadIndex()];
+
+        CountEvents(options.m_PerfCounters, context.m_Events, [&]() {
+            #pragma omp for schedule(dynamic, 1)
+            for (int t = 0; t < tileCount; t++) {
+                TraceScope trace("tile", t);
+
+                if (options.m_Integrator == AoIntegrator) RenderTileOcclusion(scene, options.m_SamplesPerPixel, options.m_AoSamples, options.m_AoDistance, tiles[t], framebuffer, context);
+                else if (options.m_Batched && !importance && !guides) RenderTileBatched(scene, lightSet, options.m_SamplesPerPixel, tiles[t], framebuffer, context);
+                else RenderTile(scene, lightSet, options.m_SamplesPerPixel, tiles[t], framebuffer, context);
+
+                if (shared) shared->TileReady(tiles[t]);
+            }
+        });
+    }
 }
 
-void main()
+// The scene of --precision double and mixed: widened at the origin, then
+// moved by the world offset in double. Mixed traverses its eye-relative
+// float copy.
+//
+SceneT<double> PreciseScene(const Scene& scene, Precision precision)
 {
-    Material     ivory(1.0, Vec4f(0.6,  0.3, 0.1, 0.0), Vec3f(0.4, 0.4, 0.3),   50.0);
-    Material     glass(1.5, Vec4f(0.0,  0.5, 0.1, 0.8), Vec3f(0.6, 0.7, 0.8),  125.0);
-    Material redRubber(1.0, Vec4f(0.9,  0.1, 0.0, 0.0), Vec3f(0.3, 0.1, 0.1),   10.0);
-    Material    mirror(1.0, Vec4f(0.0, 10.0, 0.8, 0.0), Vec3f(1.0, 1.0, 1.0), 1425.0);
+    SceneT<double> precise = SceneT<double>(scene).Placed();
 
-    std::vector<Sphere> spheres;
-    spheres.push_back(Sphere(Vec3f(-3.0,  0.0, -16.0), 2,     ivory));
-    spheres.push_back(Sphere(Vec3f(-1.0, -1.5, -12.0), 2,     glass));
-    spheres.push_back(Sphere(Vec3f( 1.5, -0.5, -18.0), 3, redRubber));
-    spheres.push_back(Sphere(Vec3f( 7.0,  5.0, -18.0), 4,    mirror));
+    if (precision == MixedPrecision) precise.BuildRelative();
 
-    std::vector<Light> lights;
-    lights.push_back(Light(Vec3f(-20.0, 20.0,  20.0), 1.5));
-    lights.push_back(Light(Vec3f( 30.0, 50.0, -25.0), 1.8));
-    lights.push_back(Light(Vec3f( 30.0, 20.0,  30.0), 1.7));
+    return precise;
+}
+
+// Float precision renders the float scene, moved by the world offset in float;
+// double and mixed convert it first.
+// "costs", when given, receives what every pixel cost; "region", when given,
+// limits tracing to its pixels and leaves the others of the framebuffer as
+// they were; "shared", when given, holds the pixels of "framebuffer" and
+// learns of every finished tile; "importance", when given, scales the
+// samples and shading effort of every pixel; "guides", when given, receives
+// the primary hit of every traced pixel.
+//
+void Render(const Scene& scene, const Options& options, Framebuffer& framebuffer, ThreadContexts& contexts, CostMap* costs = NULL,
+            const RenderRegion* region = NULL, SharedFramebuffer* shared = NULL, const ImportanceMap* importance = NULL, GuideBuffer* guides = NULL)
+{
+    const int samples = options.m_SamplesPerPixel;
 
-    Render(spheres, lights);
-}
\ No newline at end of file
+    if (options.m_Precision != FloatPrecision) RenderScene(PreciseScene(scene, options.m_Precision), options, framebuffer, contexts, costs, region, shared, importance, guides, 0, samples);
+    else if (scene.Offset()) RenderScene(scene.Placed(), options, framebuffer, contexts, costs, region, shared, importance, guides, 0, samples);
+    else RenderScene(scene, options, framebuffer, contexts, costs, region, shared, importance, guides, 0, samples);
+}
+
+// Half of the pixels, those of frame "frame"'s checkerboard, traced with their
+// guides; the resolver fills in the rest, from the previous frame when there
+// is one and "temporal" is set.
+//
+void RenderCheckerboard(const Scene& scene, const Options& options, Framebuffer& framebuffer, ThreadContexts& contexts,
+                        GuideBuffer& guides, CheckerboardResolver& resolver, int frame, bool temporal)
+{
+    RenderRegion region(Tile(0, 0, framebuffer.m_Width, framebuffer.m_Height));
+    region.m_Checkerboard = frame & 1;
+
+    Render(scene, options, framebuffer, contexts, NULL, &region, NULL, NULL, &guides);
+
+    TraceScope trace("resolve");
+
+    resolver.Resolve(framebuffer, guides, PinholeCamera(scene.m_Eye, framebuffer.m_Width, framebuffer.m_Height, (float)HalfFovTangent()), frame & 1, temporal);
+}
+
+// Samples [first, last) of every pixel of "region", added to the sums the
+// framebuffer holds from the passes before; the pass that ends with the last
+// sample divides by the sample count. Passes give the same image as one Render.
+//
+void RenderPass(const Scene& scene, const Options& options, Framebuffer& framebuffer, ThreadContexts& contexts, const RenderRegion& region, int first, int last)
+{
+    if (options.m_Precision != FloatPrecision) RenderScene(PreciseScene(scene, options.m_Precision), options, framebuffer, contexts, NULL, &region, NULL, NULL, NULL, first, last);
+    else if (scene.Offset()) RenderScene(scene.Placed(), options, framebuffer, contexts, NULL, &region, NULL, NULL, NULL, first, last);
+    else RenderScene(scene, options, framebuffer, contexts, NULL, &region, NULL, NULL, NULL, first, last);
+}
+
+// Binary PPM of the framebuffer.
+std::string EncodeImage(const Framebuffer& framebuffer)
+{
+    std::string bytes;
+
+    {
+        TraceScope trace("encode");
+
+        std::ostringstream header;
+        header << "P6\n" << framebuffer.m_Width << " " << framebuffer.m_Height << "\n255\n";
+
+        bytes = header.str();
+        bytes.reserve(bytes.size() + size_t(framebuffer.m_Width) * framebuffer.m_Height * 3);
+
+        for (int j = 0; j < framebuffer.m_Height; j++) {
+            for (int i = 0; i < framebuffer.m_Width; i++) {
+                // There is no need of the code below.
+                // It would only be in case of color overflow.
+                //
+                // Vec3f &color = framebuffer(i, j);
+                // float max = std::max(color[0], std::max(color[1], color[2]));
+                //
+                // if (max > 1) color = color * (1.0f / max);
+
+                for (size_t k = 0; k < 3; k++) {
+                    bytes += (char)(255 * std::max(0.0f, std::min(1.0f, framebuffer(i, j)[k])));
+                }
+            }
+        }
+    }
+
+    return bytes;
+}
+
+void WriteImage(const Framebuffer& framebuffer, const char* path)
+{
+    const std::string bytes = EncodeImage(framebuffer);
+
+    TraceScope trace("write");
+
+    std::ofstream ofs;
+    ofs.open(path, std::ofstream::out | std::ofstream::binary);
+    ofs.write(bytes.data(), bytes.size());
+    ofs.close();
+}
+
+// False-color heatmaps next to the image, one per metric. The scale spans
+// the cheapest pixel to the 99.9th percentile: interrupts and page faults
+// would otherwise set the top of the cycle scale.
+//
+void WriteHeatmaps(const CostMap& costs)
+{
+    const CostMetric metrics[] = { CostRays, CostTests, CostCycles };
+    const char* paths[] = { "outputs/heatmap-rays.ppm", "outputs/heatmap-tests.ppm", "outputs/heatmap-cycles.ppm" };
+    const char* names[] = { "rays", "intersection tests", "cycles" };
+
+    for (int m = 0; m < 3; m++) {
+        double low = costs.Percentile(metrics[m], 0.0), high = costs.Percentile(metrics[m], 0.999);
+
+        WriteImage(HeatmapImage(costs, metrics[m], low, high), paths[m]);
+
+        std::cout << paths[m] << ": " << names[m] << " per pixel, log scale from " << (uint64_t)low << " to " << (uint64_t)high << ".\n";
+    }
+}
+
+// Energy since the meter started, over "frames" frames that traced "stats".
+void ReportEnergy(const EnergyMeter& energy, const RenderStats& stats, int frames = 1)
+{
+    if (!energy.Available())
+    {
+        std::cout << "Energy counters are not available (no readable RAPL zones under /sys/class/powercap).\n";
+        return;
+    }
+
+    double joules = energy.Joules();
+
+    std::cout << "Energy:";
+    for (size_t i = 0; i < energy.m_Domains.size(); i++) std::cout << " " << energy.m_Domains[i].m_Name;
+    std::cout << ", " << std::fixed << std::setprecision(3) << joules / frames << " J per frame, "
+              << std::setprecision(2) << stats.TotalRays() / joules * 1e-6 << " Mrays/J.\n";
+}
+
+void PrintPerfRow(const char* name, const PerfSample& sample)
+{
+    std::cout << std::setw(16) << std::left << name << std::right;
+
+    for (int e = 0; e < PerfEventCount; e++) {
+        if (sample.Has(e)) std::cout << std::setw(15) << sample.m_Values[e];
+        else std::cout << std::setw(15) << "n/a";
+    }
+
+    std::cout << std::setw(8) << std::fixed << std::setprecision(2) << sample.Ratio(PerfInstructions, PerfCycles) << "\n";
+}
+
+// Counters per stage of the frame, per render thread, and normalized by the
+// work done: cache misses per ray say whether tracing waits on memory, branch
+// misses per intersection test how predictable the traversal is. The scene
+// build and output stages are left out when not given.
+//
+void ReportPerfCounters(const ThreadContexts& contexts, const PerfSample* build = NULL, const PerfSample* output = NULL)
+{
+    PerfSample render;
+
+    for (size_t i = 0; i < contexts.size(); i++) render += contexts[i].m_Events;
+
+    if (!render.Has(PerfCycles) && !render.Has(PerfInstructions))
+    {
+        std::cout << "Hardware counters are not available (no Linux perf_event support, or perf_event_paranoid too high).\n";
+        return;
+    }
+
+    std::cout << std::setw(16) << std::left << "stage" << std::right;
+    for (int e = 0; e < PerfEventCount; e++) std::cout << std::setw(15) << PerfEventName(e);
+    std::cout << std::setw(8) << "IPC" << "\n";
+
+    if (build) PrintPerfRow("scene build", *build);
+    PrintPerfRow("render", render);
+
+    for (size_t i = 0; i < contexts.size(); i++) {
+        std::string name = "  thread " + std::to_string(i);
+        PrintPerfRow(name.c_str(), contexts[i].m_Events);
+    }
+
+    if (output) PrintPerfRow("encode + write", *output);
+
+    const RenderStats stats = MergeStats(contexts);
+    const double rays = (double)stats.TotalRays(), tests = (double)stats.m_IntersectionTests;
+
+    // Ratios only when there is work to divide by: an empty crop traces nothing.
+    if (rays > 0)
+    {
+        std::cout << "\nRender, per ray:" << std::setprecision(3);
+
+        if (render.Has(PerfCycles)) std::cout << " " << render.m_Values[PerfCycles] / rays << " cycles,";
+        if (render.Has(PerfL1dMisses)) std::cout << " " << render.m_Values[PerfL1dMisses] / rays << " L1d misses,";
+        if (render.Has(PerfLlcMisses)) std::cout << " " << render.m_Values[PerfLlcMisses] / rays << " LLC misses,";
+
+        std::cout << " " << stats.TotalRays() << " rays.\n";
+    }
+
+    if (render.Has(PerfBranchMisses) && tests > 0) std::cout << "Branch misses per intersection test: " << std::setprecision(4) << render.m_Values[PerfBranchMisses] / tests << ".\n";
+}
+
+// Renders the scene with 1, 2, 4... threads and compares per-thread counters
+// packed next to each other against the padded ThreadContext layout.
+//
+void BenchScaling(const Scene& scene, const Options& options, const PerfSample& buildEvents)
+{
+    const int maxThreads = ThreadCount();
+    const int repeats = std::max(1, options.m_BenchRepeats);
+
+    std::vector<int> threadCounts;
+
+    for (int n = 1; n < maxThreads; n *= 2) threadCounts.push_back(n);
+    threadCounts.push_back(maxThreads);
+
+    Framebuffer framebuffer(1024, 768);
+    ThreadContexts contexts;
+    std::vector<ThreadContexts> counted; // With --perf-counters, the contexts of every row.
+    double baseline = 0.0;
+
+    EnergyMeter energy;
+
+    std::cout << "Render scaling (" << repeats << " frames per row):\n";
+    std::cout << std::setw(8) << "threads" << std::setw(12) << "ms/frame" << std::setw(14) << "Mrays/s" << std::setw(10) << "speedup" << std::setw(12) << "efficiency";
+    if (energy.Available()) std::cout << std::setw(10) << "J/frame" << std::setw(10) << "Mrays/J";
+    std::cout << "\n";
+
+    for (size_t k = 0; k < threadCounts.size(); k++) {
+        SetThreadCount(threadCounts[k]);
+        contexts.assign(threadCounts[k], ThreadContext());
+
+        energy.Start();
+        Timer timer;
+        for (int r = 0; r < repeats; r++) Render(scene, options, framebuffer, contexts);
+        double seconds = timer.Seconds() / repeats;
+        double joules = energy.Joules() / repeats;
+
+        if (k == 0) baseline = seconds;
+
+        double rays = (double)MergeStats(contexts).TotalRays() / repeats;
+
+        std::cout << std::setw(8) << threadCounts[k] << std::setw(12) << std::fixed << std::setprecision(2) << seconds * 1e3
+                  << std::setw(14) << rays / seconds * 1e-6 << std::setw(10) << baseline / seconds
+                  << std::setw(11) << 100.0 * baseline / seconds / threadCounts[k] << "%";
+        if (energy.Available()) std::cout << std::setw(10) << joules << std::setw(10) << rays / joules * 1e-6;
+        std::cout << "\n";
+
+        if (options.m_PerfCounters) counted.push_back(contexts);
+    }
+
+    for (size_t k = 0; k < counted.size(); k++) {
+        std::cout << "\nHardware counters, " << threadCounts[k] << (threadCounts[k] > 1 ? " threads, " : " thread, ") << repeats << " frames:\n";
+
+        ReportPerfCounters(counted[k], k == 0 ? &buildEvents : NULL);
+    }
+
+    // Counter microbenchmark: the same increments, once into adjacent counters
+    // (8 threads per cache line) and once into padded per-thread contexts.
+    const int increments = 1 << 24;
+
+    std::cout << "\nCounter increments (" << increments << " per thread):\n";
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "packed ms" << std::setw(14) << "padded ms\n";
+
+    for (size_t k = 0; k < threadCounts.size(); k++) {
+        const int threads = threadCounts[k];
+        SetThreadCount(threads);
+
+        AlignedVector<uint64_t> packed(threads, 0);
+        contexts.assign(threads, ThreadContext());
+
+        Timer packedTimer;
+        #pragma omp parallel for schedule(static, 1)
+        for (int t = 0; t < threads; t++) {
+            volatile uint64_t* counter = &packed[t];
+            for (int n = 0; n < increments; n++) *counter = *counter + 1;
+        }
+        double packedSeconds = packedTimer.Seconds();
+
+        Timer paddedTimer;
+        #pragma omp parallel for schedule(static, 1)
+        for (int t = 0; t < threads; t++) {
+            volatile uint64_t* counter = &contexts[t].m_Stats.m_IntersectionTests;
+            for (int n = 0; n < increments; n++) *counter = *counter + 1;
+        }
+        double paddedSeconds = paddedTimer.Seconds();
+
+        std::cout << std::setw(8) << threads << std::setw(14) << packedSeconds * 1e3 << std::setw(13) << paddedSeconds * 1e3 << "\n";
+    }
+
+    SetThreadCount(maxThreads);
+}
+
+// Renders the scene in each precision and reports the time per frame and the
+// difference to the double render, at the offset given by --world-offset.
+//
+void BenchPrecision(const Scene& scene, const Options& options)
+{
+    const Precision precisions[] = { FloatPrecision, MixedPrecision, DoublePrecision };
+    const char* names[] = { "float", "mixed", "double" };
+    const int repeats = std::max(1, options.m_BenchRepeats);
+
+    Framebuffer frames[3] = { Framebuffer(1024, 768), Framebuffer(1024, 768), Framebuffer(1024, 768) };
+    ThreadContexts contexts;
+    double seconds[3], rays[3], joules[3];
+    EnergyMeter energy;
+
+    for (int k = 0; k < 3; k++) {
+        Options mode = options;
+        mode.m_Precision = precisions[k];
+        contexts.assign(ThreadCount(), ThreadContext());
+
+        energy.Start();
+        Timer timer;
+        for (int r = 0; r < repeats; r++) Render(scene, mode, frames[k], contexts);
+        seconds[k] = timer.Seconds() / repeats;
+        joules[k] = energy.Joules() / repeats;
+        rays[k] = (double)MergeStats(contexts).TotalRays() / repeats;
+    }
+
+    std::cout << "Precision (" << repeats << " frames per row, world offset " << options.m_WorldOffset << "):\n";
+    std::cout << std::setw(8) << "mode" << std::setw(12) << "ms/frame" << std::setw(14) << "Mrays/s" << std::setw(10) << "cost" << std::setw(15) << "rmse vs double";
+    if (energy.Available()) std::cout << std::setw(10) << "J/frame" << std::setw(10) << "Mrays/J";
+    std::cout << "\n";
+
+    for (int k = 0; k < 3; k++) {
+        double squares = 0.0;
+
+        for (int j = 0; j < frames[k].m_Height; j++) {
+            for (int i = 0; i < frames[k].m_Width; i++) {
+                Vec3f difference = frames[k](i, j) - frames[2](i, j);
+                squares += difference * difference;
+            }
+        }
+
+        double rmse = std::sqrt(squares / (3.0 * frames[k].m_Width * frames[k].m_Height));
+
+        std::cout << std::setw(8) << names[k] << std::setw(12) << std::fixed << std::setprecision(2) << seconds[k] * 1e3
+                  << std::setw(14) << rays[k] / seconds[k] * 1e-6 << std::setw(9) << seconds[k] / seconds[0] << "x"
+                  << std::setw(15) << std::setprecision(5) << rmse << std::setprecision(2);
+        if (energy.Available()) std::cout << std::setw(10) << joules[k] << std::setw(10) << rays[k] / joules[k] * 1e-6;
+        std::cout << "\n";
+    }
+}
+
+// Synthetic rays for the intersection benchmark. {{{
+struct RaySet
+{
+    const char* m_Name;
+    std::vector<Vec3f> m_Origins;
+    std::vector<Vec3f> m_Directions;
+    std::vector<float> m_TMax;
+};
+
+// Camera rays in scanline order over the whole image: neighbours are coherent.
+RaySet PrimaryRays(const Scene& scene, int width, int height)
+{
+    RaySet rays;
+    rays.m_Name = "primary";
+
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            rays.m_Origins.push_back(scene.m_Eye);
+            rays.m_Directions.push_back(PrimaryDirection<float>(i, j, width, height));
+            rays.m_TMax.push_back(std::numeric_limits<float>::max());
+        }
+    }
+
+    return rays;
+}
+
+// Points on random spheres, leaving in cosine distributed directions: the
+// bounce rays of a path tracer, incoherent from one ray to the next. With
+// "toLights" they head for a random light instead and stop at it.
+//
+RaySet SurfaceRays(const Scene& scene, int count, bool toLights, unsigned seed)
+{
+    RaySet rays;
+    rays.m_Name = toLights ? "shadow" : "diffuse";
+
+    for (int i = 0; i < count; i++) {
+        Random random(HashSeed(seed, i, toLights));
+        const Sphere& sphere = scene.m_Spheres[random.NextUInt() % scene.m_Spheres.size()];
+
+        Vec3f normal = FromLocal(Vec3f(0.0f, 0.0f, 1.0f), 2.0f * random.NextFloat() - 1.0f, 2.0f * Pi * random.NextFloat());
+        Vec3f origin = sphere.m_Center + normal * (sphere.m_Radius + 1e-3f);
+
+        if (toLights)
+        {
+            Vec3f toLight = scene.m_Lights[random.NextUInt() % scene.m_Lights.size()].m_Position - origin;
+            float distance = toLight.norm();
+
+            rays.m_Origins.push_back(origin);
+            rays.m_Directions.push_back(toLight * (1.0f / distance));
+            rays.m_TMax.push_back(distance);
+        }
+        else
+        {
+            float u1 = random.NextFloat(), u2 = random.NextFloat();
+
+            rays.m_Origins.push_back(origin);
+            rays.m_Directions.push_back(FromLocal(normal, std::sqrt(u1), 2.0f * Pi * u2));
+            rays.m_TMax.push_back(std::numeric_limits<float>::max());
+        }
+    }
+
+    return rays;
+}
+// }}}
+
+// Times one kernel over a ray set; "kernel" returns whether the ray hit.
+template <typename Kernel> double MeasureKernel(const RaySet& rays, int repeats, Kernel kernel, size_t& hits, PerfCounters& counters)
+{
+    const int count = (int)rays.m_Origins.size();
+
+    hits = 0;
+
+    counters.Start();
+    Timer timer;
+
+    for (int r = 0; r < repeats; r++) {
+        for (int i = 0; i < count; i++) hits += kernel(rays.m_Origins[i], rays.m_Directions[i], rays.m_TMax[i]);
+    }
+
+    double seconds = timer.Seconds();
+    counters.Stop();
+
+    return seconds;
+}
+
+template <typename Kernel> void BenchKernel(const char* name, const RaySet& rays, int repeats, Kernel kernel)
+{
+    const double total = (double)rays.m_Origins.size() * repeats;
+
+    PerfCounters counters;
+    size_t hits;
+    double seconds = MeasureKernel(rays, repeats, kernel, hits, counters);
+
+    std::cout << std::setw(10) << rays.m_Name << std::setw(8) << name << std::setw(10) << std::fixed << std::setprecision(2) << seconds * 1e9 / total
+              << std::setw(9) << 100.0 * hits / total << "%";
+
+    if (counters.Available()) std::cout << std::setw(8) << counters.InstructionsPerCycle() << "\n";
+    else std::cout << std::setw(8) << "n/a" << "\n";
+}
+
+// Intersection kernels in isolation from shading, single threaded, over
+// coherent primary, incoherent diffuse and shadow rays of the scene.
+//
+void BenchIntersect(const Scene& scene, const Options& options)
+{
+    const int repeats = std::max(1, options.m_BenchRepeats);
+    const SphereSoA soa(scene.m_Spheres);
+
+    RaySet sets[] = {
+        PrimaryRays(scene, 512, 384),
+        SurfaceRays(scene, 512 * 384, false, options.m_Seed),
+        SurfaceRays(scene, 512 * 384, true, options.m_Seed),
+    };
+
+    std::cout << "Intersection kernels (" << scene.m_Spheres.size() << " spheres, " << sets[0].m_Origins.size() << " rays per set, " << repeats << " passes):\n";
+    std::cout << std::setw(10) << "rays" << std::setw(8) << "kernel" << std::setw(10) << "ns/ray" << std::setw(10) << "hits" << std::setw(8) << "IPC" << "\n";
+
+    for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++) {
+        const RaySet& rays = sets[s];
+
+        BenchKernel("scalar", rays, repeats, [&](const Vec3f& o, const Vec3f& d, float tMax) { float t; return IntersectSpheresScalar(scene.m_Spheres, o, d, tMax, t) != NoSphere; });
+#if defined(__SSE2__) || defined(_M_X64)
+        BenchKernel("sse", rays, repeats, [&](const Vec3f& o, const Vec3f& d, float tMax) { float t; return IntersectSpheresSse(soa, o, d, tMax, t) != NoSphere; });
+#endif
+#if defined(__AVX2__)
+        BenchKernel("avx2", rays, repeats, [&](const Vec3f& o, const Vec3f& d, float tMax) { float t; return IntersectSpheresAvx2(soa, o, d, tMax, t) != NoSphere; });
+#endif
+        BenchKernel("plane", rays, repeats, [&](const Vec3f& o, const Vec3f& d, float tMax) { float t; return scene.m_Checkerboard.RayIntersect(o, d, t) && t < tMax; });
+    }
+}
+
+// Everything the sample sums depend on, stored with a checkpoint so that it
+// is not resumed with a different scene or sampling, and part of the key of
+// the perf-check history.
+std::string CheckpointSettings(const Options& options)
+{
+    std::ostringstream settings;
+
+    settings << std::setprecision(9) << "scene " << SceneKindName(options.m_Scene) << " " << options.m_SceneSize << " seed " << options.m_Seed
+             << " spp " << options.m_SamplesPerPixel << " precision " << options.m_Precision << " batched " << options.m_Batched
+             << " light-radius " << options.m_LightRadius << " light-samples " << options.m_LightSamples << " mis " << options.m_Heuristic
+             << " microfacet " << options.m_Microfacet << " world-offset " << options.m_WorldOffset
+             << " integrator " << options.m_Integrator << " ao " << options.m_AoSamples << " " << options.m_AoDistance;
+
+    return settings.str();
+}
+
+// Regression gate: samples render and intersection throughput, compares
+// them with the baseline stored in the history file using Welch's t-test and
+// appends the new samples. Returns non-zero when Render throughput dropped by
+// more than the threshold with p < 0.05. Without a baseline, or with
+// --perf-baseline, the samples become the new baseline.
+//
+int PerfCheck(const Scene& scene, const Options& options, const PerfSample& buildEvents)
+{
+    const int samples = std::max(5, options.m_BenchRepeats);
+    const double significance = 0.05;
+
+    // Baselines are only compared with runs of the same workload and thread
+    // count. The history separates fields with spaces, so the key has none.
+    std::string settings = CheckpointSettings(options);
+    std::replace(settings.begin(), settings.end(), ' ', ',');
+
+    std::ostringstream tag;
+    tag << settings << ",threads," << ThreadCount();
+
+    PerfRecord render, intersect;
+    render.m_Metric = "render-mrays:" + tag.str();
+    intersect.m_Metric = "intersect-mrays:" + tag.str();
+
+    // Render throughput in Mrays/s, one frame per sample after a warm-up frame.
+    Framebuffer framebuffer(1024, 768);
+    ThreadContexts contexts;
+
+    Render(scene, options, framebuffer, contexts);
+
+    for (int k = 0; k < samples; k++) {
+        contexts.assign(ThreadCount(), ThreadContext());
+
+        Timer timer;
+        Render(scene, options, framebuffer, contexts);
+        double seconds = timer.Seconds();
+
+        render.m_Samples.push_back(MergeStats(contexts).TotalRays() / seconds * 1e-6);
+    }
+
+    if (options.m_PerfCounters)
+    {
+        std::cout << "Hardware counters, last render sample:\n";
+
+        ReportPerfCounters(contexts, &buildEvents);
+
+        std::cout << "\n";
+    }
+
+    // Scalar sphere kernel, the one CastRay uses, on primary rays.
+    const RaySet rays = PrimaryRays(scene.Placed(), 512, 384);
+
+    for (int k = 0; k < samples; k++) {
+        PerfCounters counters;
+        size_t hits;
+        double seconds = MeasureKernel(rays, 1, [&](const Vec3f& o, const Vec3f& d, float tMax) { float t; return IntersectSpheresScalar(scene.m_Spheres, o, d, tMax, t) != NoSphere; }, hits, counters);
+
+        intersect.m_Samples.push_back(rays.m_Origins.size() / seconds * 1e-6);
+    }
+
+    const std::vector<PerfRecord> history = LoadPerfHistory(options.m_PerfHistory);
+    const PerfRecord* records[] = { &render, &intersect };
+    bool regressed = false;
+
+    std::cout << "Performance check (" << samples << " samples, threshold " << options.m_PerfThreshold << "%, history " << options.m_PerfHistory << "):\n";
+    std::cout << std::setw(40) << std::left << "metric" << std::right << std::setw(18) << "baseline" << std::setw(18) << "current"
+              << std::setw(10) << "change" << std::setw(10) << "p" << "\n";
+
+    for (int m = 0; m < 2; m++) {
+        PerfRecord record = *records[m];
+        const PerfRecord* baseline = FindBaseline(history, record.m_Metric);
+
+        std::cout << std::setw(40) << std::left << record.m_Metric << std::right << std::fixed << std::setprecision(2);
+
+        if (!baseline || options.m_PerfBaseline)
+        {
+            record.m_Baseline = true;
+
+            std::cout << std::setw(18) << "-" << std::setw(10) << Mean(record.m_Samples) << " +- " << std::setw(4) << std::sqrt(Variance(record.m_Samples))
+                      << "  (new baseline)\n";
+        }
+        else
+        {
+            record.m_Baseline = false;
+
+            WelchTest test(baseline->m_Samples, record.m_Samples);
+            double change = 100.0 * (Mean(record.m_Samples) / Mean(baseline->m_Samples) - 1.0);
+            bool slower = change < -options.m_PerfThreshold && test.m_PValue < significance;
+
+            std::cout << std::setw(10) << Mean(baseline->m_Samples) << " +- " << std::setw(4) << std::sqrt(Variance(baseline->m_Samples))
+                      << std::setw(10) << Mean(record.m_Samples) << " +- " << std::setw(4) << std::sqrt(Variance(record.m_Samples))
+                      << std::setw(9) << std::showpos << change << std::noshowpos << "%" << std::setw(10) << std::setprecision(4) << test.m_PValue
+                      << (slower ? "  REGRESSION" : "") << "\n";
+
+            // Only Render gates; the kernel is reported to explain it.
+            if (slower && m == 0) regressed = true;
+        }
+
+        if (!AppendPerfHistory(options.m_PerfHistory, record)) std::cerr << "Cannot write \"" << options.m_PerfHistory << "\".\n";
+    }
+
+    return regressed ? 1 : 0;
+}
+
+// Traces only the crop rectangle and/or mask of the frame and merges it into
+// an earlier image, so a change to one object does not cost a full frame.
+//
+int RenderPartial(const Scene& scene, const Options& options)
+{
+    Framebuffer framebuffer(1024, 768);
+    RenderRegion region(Tile(0, 0, framebuffer.m_Width, framebuffer.m_Height));
+    ThreadContexts contexts;
+
+    if (options.m_Crop)
+    {
+        const int* rect = options.m_CropRect;
+
+        region.m_Bounds = Tile(std::max(rect[0], 0), std::max(rect[1], 0), std::min(rect[2], framebuffer.m_Width), std::min(rect[3], framebuffer.m_Height));
+    }
+
+    if (options.m_Mask && !LoadMask(options.m_Mask, framebuffer.m_Width, framebuffer.m_Height, region))
+    {
+        std::cerr << "Cannot read a " << framebuffer.m_Width << "x" << framebuffer.m_Height << " PGM/PPM mask from \"" << options.m_Mask << "\".\n";
+        return 1;
+    }
+
+    const char* base = options.m_Merge ? options.m_Merge : "outputs/image.ppm";
+
+    // A missing base starts from black; one that does not fit is an error.
+    if (!LoadFramebuffer(base, framebuffer))
+    {
+        if (std::ifstream(base).good())
+        {
+            std::cerr << "\"" << base << "\" is not a " << framebuffer.m_Width << "x" << framebuffer.m_Height << " PPM image.\n";
+            return 1;
+        }
+
+        std::cerr << "Cannot read \"" << base << "\"; pixels outside the region are black.\n";
+    }
+
+    const size_t pixels = region.PixelCount();
+    EnergyMeter energy;
+    Timer timer;
+
+    if (pixels) Render(scene, options, framebuffer, contexts, NULL, &region);
+
+    const double seconds = timer.Seconds();
+
+    if (options.m_Energy) ReportEnergy(energy, MergeStats(contexts));
+
+    WriteImage(framebuffer, "outputs/image.ppm");
+
+    std::cout << "Region: " << pixels << " pixels (" << std::fixed << std::setprecision(1) << 100.0 * pixels / (framebuffer.m_Width * framebuffer.m_Height)
+              << "% of the frame) rendered in " << std::setprecision(2) << seconds * 1e3 << " ms.\n";
+
+    return 0;
+}
+
+// Renders one sample per pixel per pass, in bands of tile rows, and hands
+// the sums to a background writer every --checkpoint-interval seconds, even
+// in the middle of a pass. A resumed render ends with the same image, byte
+// for byte, as an uninterrupted one.
+//
+int RenderCheckpointed(const Scene& scene, const Options& options)
+{
+    Framebuffer framebuffer(1024, 768);
+    ThreadContexts contexts;
+    CheckpointWriter writer;
+
+    const std::string settings = CheckpointSettings(options);
+    const int samples = options.m_SamplesPerPixel;
+    std::vector<uint32_t> counts(size_t(framebuffer.m_Width) * framebuffer.m_Height, 0);
+    uint32_t first = 0, most = 0;
+
+    if (options.m_Resume && std::ifstream(options.m_Checkpoint).good())
+    {
+        Checkpoint checkpoint;
+
+        if (!checkpoint.Read(options.m_Checkpoint) || checkpoint.m_Width != framebuffer.m_Width || checkpoint.m_Height != framebuffer.m_Height)
+        {
+            std::cerr << "\"" << options.m_Checkpoint << "\" is not a checkpoint of a " << framebuffer.m_Width << "x" << framebuffer.m_Height << " render.\n";
+            return 1;
+        }
+
+        if (checkpoint.m_Settings != settings)
+        {
+            std::cerr << "\"" << options.m_Checkpoint << "\" was written with other settings:\n  " << checkpoint.m_Settings << "\nnot\n  " << settings << "\n";
+            return 1;
+        }
+
+        checkpoint.SampleRange(first, most);
+
+        // Bands end a pass in turn, so no pixel is more than one sample ahead.
+        if (most > (uint32_t)samples || most > first + 1)
+        {
+            std::cerr << "\"" << options.m_Checkpoint << "\" does not stop within a pass.\n";
+            return 1;
+        }
+
+        checkpoint.Restore(framebuffer);
+        counts = checkpoint.m_Samples;
+
+        std::cout << "Resuming after " << first << " of " << samples << " samples per pixel, "
+                  << std::count(counts.begin(), counts.end(), first + 1) << " pixels with one more.\n";
+    }
+    else if (options.m_Resume) std::cout << "No checkpoint in \"" << options.m_Checkpoint << "\" yet; starting from the first sample.\n";
+
+    // Bands of tile rows, with a few tiles for every thread to balance.
+    const int tilesPerRow = (framebuffer.m_Width + TileSize - 1) / TileSize;
+    const int bandHeight = TileSize * std::max(1, (4 * ThreadCount() + tilesPerRow - 1) / tilesPerRow);
+    RenderRegion band(Tile(0, 0, framebuffer.m_Width, framebuffer.m_Height));
+
+    // The pass a checkpoint stopped in skips the pixels it had done.
+    if (most > first)
+    {
+        band.m_MaskWidth = framebuffer.m_Width;
+        band.m_Mask.resize(counts.size());
+
+        for (size_t k = 0; k < counts.size(); k++) band.m_Mask[k] = counts[k] == first;
+    }
+
+    Timer sinceCheckpoint;
+    EnergyMeter energy;
+
+    for (int s = first; s < samples; s++) {
+        for (int y = 0; y < framebuffer.m_Height; y += bandHeight) {
+            const int end = std::min(y + bandHeight, framebuffer.m_Height);
+
+            band.m_Bounds = Tile(0, y, framebuffer.m_Width, end);
+            RenderPass(scene, options, framebuffer, contexts, band, s, s + 1);
+
+            for (size_t k = size_t(y) * framebuffer.m_Width; k < size_t(end) * framebuffer.m_Width; k++) counts[k] = s + 1;
+
+            // Nothing is left to resume after the last band of the last pass.
+            if ((s + 1 < samples || end < framebuffer.m_Height) && sinceCheckpoint.Seconds() >= options.m_CheckpointInterval)
+            {
+                writer.Write(options.m_Checkpoint, settings, framebuffer, counts);
+                sinceCheckpoint.Reset();
+            }
+        }
+
+        band.m_Mask.clear();
+    }
+
+    // Only the passes rendered by this run, after a resume.
+    if (options.m_Energy) ReportEnergy(energy, MergeStats(contexts));
+
+    writer.Wait();
+    WriteImage(framebuffer, "outputs/image.ppm");
+
+    if (writer.m_Failed)
+    {
+        std::cerr << "Cannot write \"" << options.m_Checkpoint << "\".\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+// Frame "frame" of "frames": the camera sways once left and right over the
+// sequence, so an encoder sees real motion rather than noise.
+Scene AnimationFrame(const Scene& scene, int frame, int frames)
+{
+    Scene moved = scene;
+    float angle = 2.0f * (float)M_PI * frame / frames;
+
+    moved.m_Eye = scene.m_Eye + Vec3f(2.0f * std::sin(angle), 0.5f * (1.0f - std::cos(angle)), 0.0f);
+
+    return moved;
+}
+
+// Renders the frames one by one and writes each to the stream as soon as it
+// is done, for an encoder on the other end of a pipe.
+//
+int StreamFrames(const Scene& scene, const Options& options)
+{
+    FrameStream stream;
+
+    if (!stream.Open(options.m_Stream, options.m_StreamFormat, options.m_FrameRate))
+    {
+        std::cerr << "Cannot open \"" << options.m_Stream << "\".\n";
+        return 1;
+    }
+
+    Framebuffer framebuffer(1024, 768);
+    ThreadContexts contexts;
+    const int checkerboard = options.m_Checkerboard ? 1 : 0;
+    GuideBuffer guides(framebuffer.m_Width * checkerboard, framebuffer.m_Height * checkerboard);
+    CheckerboardResolver resolver(framebuffer.m_Width * checkerboard, framebuffer.m_Height * checkerboard);
+    EnergyMeter energy;
+    Timer timer;
+
+    for (int f = 0; f < options.m_Frames; f++) {
+        const Scene frame = options.m_Frames > 1 ? AnimationFrame(scene, f, options.m_Frames) : scene;
+
+        if (checkerboard) RenderCheckerboard(frame, options, framebuffer, contexts, guides, resolver, f, true);
+        else Render(frame, options, framebuffer, contexts);
+
+        TraceScope trace("stream");
+
+        if (!stream.WriteFrame(framebuffer))
+        {
+            std::cerr << "Cannot write frame " << f << " to \"" << options.m_Stream << "\".\n";
+            return 1;
+        }
+    }
+
+    std::cout << options.m_Frames << " frames streamed in " << std::fixed << std::setprecision(2) << timer.Seconds() << " s.\n";
+
+    if (options.m_Energy) ReportEnergy(energy, MergeStats(contexts), options.m_Frames);
+
+    return 0;
+}
+
+// Renders straight into a shared memory segment for a compositor to map;
+// nothing is written to disk.
+//
+int RenderShared(const Scene& scene, const Options& options)
+{
+    const int width = 1024, height = 768;
+    SharedFramebuffer shared;
+
+    if (!shared.Open(options.m_Shm, width, height))
+    {
+        std::cerr << "Cannot map the shared memory object \"" << options.m_Shm << "\".\n";
+        return 1;
+    }
+
+    Framebuffer framebuffer(width, height, shared.Pixels());
+    ThreadContexts contexts;
+    EnergyMeter energy;
+    Timer timer;
+
+    for (int f = 0; f < options.m_Frames; f++) {
+        shared.BeginFrame();
+        Render(options.m_Frames > 1 ? AnimationFrame(scene, f, options.m_Frames) : scene, options, framebuffer, contexts, NULL, NULL, &shared);
+        shared.EndFrame();
+    }
+
+    std::cout << options.m_Frames << " frames rendered into shared memory \"" << options.m_Shm << "\" (" << shared.m_Size / 1024 << " KiB) in "
+              << std::fixed << std::setprecision(2) << timer.Seconds() << " s.\n";
+
+    if (options.m_Energy) ReportEnergy(energy, MergeStats(contexts), options.m_Frames);
+
+    return 0;
+}
+
+// Renders the animation to outputs/frame-NNNN.ppm. Each encoded frame is
+// handed to the output backend, which writes it while the next one renders.
+//
+int RenderFrames(const Scene& scene, const Options& options)
+{
+    Framebuffer framebuffer(1024, 768);
+    ThreadContexts contexts;
+    AsyncWriter writer(options.m_OutputBackend, options.m_OutputDepth);
+    const int checkerboard = options.m_Checkerboard ? 1 : 0;
+    GuideBuffer guides(framebuffer.m_Width * checkerboard, framebuffer.m_Height * checkerboard);
+    CheckerboardResolver resolver(framebuffer.m_Width * checkerboard, framebuffer.m_Height * checkerboard);
+    double renderSeconds = 0.0, encodeSeconds = 0.0, reprojected = 0.0;
+    EnergyMeter energy;
+    Timer total;
+
+    for (int f = 0; f < options.m_Frames; f++) {
+        Timer timer;
+
+        if (checkerboard)
+        {
+            RenderCheckerboard(AnimationFrame(scene, f, options.m_Frames), options, framebuffer, contexts, guides, resolver, f, true);
+            reprojected += resolver.m_Reprojected / double(resolver.m_Reprojected + resolver.m_Interpolated);
+        }
+        else Render(AnimationFrame(scene, f, options.m_Frames), options, framebuffer, contexts);
+        renderSeconds += timer.Seconds();
+        timer.Reset();
+
+        std::ostringstream path;
+        path << "outputs/frame-" << std::setw(4) << std::setfill('0') << f << ".ppm";
+
+        std::string bytes = EncodeImage(framebuffer);
+        encodeSeconds += timer.Seconds();
+
+        TraceScope trace("queue");
+
+        writer.Write(path.str(), std::move(bytes));
+    }
+
+    {
+        TraceScope trace("drain");
+
+        writer.Finish();
+    }
+
+    const OutputStats& stats = writer.m_Stats;
+
+    std::cout << std::fixed << std::setprecision(2) << stats.m_Files << " frames, " << stats.m_Bytes / 1048576.0 << " MiB, written with "
+              << OutputBackendName(writer.m_Backend) << " (depth " << writer.m_Depth << ") in " << total.Seconds() << " s.\n"
+              << "Render " << renderSeconds << " s, encode " << encodeSeconds << " s; output busy " << stats.m_Busy * 1e3 << " ms, of which "
+              << stats.m_Stall * 1e3 << " ms stalled the renderer: " << std::setprecision(1) << 100.0 * stats.Overlap() << "% overlapped.\n";
+
+    if (checkerboard) std::cout << "Checkerboard: " << 100.0 * reprojected / options.m_Frames << "% of the skipped pixels reused from the previous frame.\n";
+
+    // Encoding and output overlap the renders, so they are counted too.
+    if (options.m_Energy) ReportEnergy(energy, MergeStats(contexts), options.m_Frames);
+
+    if (stats.m_Failed)
+    {
+        std::cerr << stats.m_Failed << " frames could not be written.\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+// Foveated render: samples per pixel, light samples and ray depth follow an
+// importance map from --focus or --importance. With --heatmap the cost maps
+// show where the rays went.
+//
+int RenderFoveated(const Scene& scene, const Options& options)
+{
+    Framebuffer framebuffer(1024, 768);
+    ImportanceMap importance(framebuffer.m_Width, framebuffer.m_Height, options.m_SamplesPerPixel, options.m_LightSamples, 5, options.m_MinDepth);
+    ThreadContexts contexts;
+
+    if (options.m_Importance)
+    {
+        if (!importance.Load(options.m_Importance, options.m_ImportanceFloor, 32))
+        {
+            std::cerr << "Cannot read a " << framebuffer.m_Width << "x" << framebuffer.m_Height << " PGM/PPM importance map from \"" << options.m_Importance << "\".\n";
+            return 1;
+        }
+    }
+    else importance.Radial(options.m_FocusPoint[0], options.m_FocusPoint[1], options.m_FocusPoint[2], options.m_ImportanceFloor);
+
+    CostMap costs(framebuffer.m_Width, framebuffer.m_Height);
+    EnergyMeter energy;
+    Timer timer;
+
+    Render(scene, options, framebuffer, contexts, options.m_Heatmap ? &costs : NULL, NULL, NULL, &importance);
+
+    const double seconds = timer.Seconds();
+
+    if (options.m_Energy) ReportEnergy(energy, MergeStats(contexts));
+
+    WriteImage(framebuffer, "outputs/image.ppm");
+
+    if (options.m_Heatmap) WriteHeatmaps(costs);
+
+    std::cout << "Importance: " << std::fixed << std::setprecision(1) << 100.0 * importance.SampleShare() << "% of the samples, "
+              << MergeStats(contexts).TotalRays() << " rays, rendered in " << std::setprecision(2) << seconds * 1e3 << " ms.\n";
+
+    return 0;
+}
+
+// Checkerboard render of a single image: half of the pixels traced, the
+// others interpolated along the edges the guides show.
+//
+int RenderCheckerboardImage(const Scene& scene, const Options& options)
+{
+    Framebuffer framebuffer(1024, 768);
+    GuideBuffer guides(framebuffer.m_Width, framebuffer.m_Height);
+    CheckerboardResolver resolver(framebuffer.m_Width, framebuffer.m_Height);
+    ThreadContexts contexts;
+    EnergyMeter energy;
+    Timer timer;
+
+    RenderCheckerboard(scene, options, framebuffer, contexts, guides, resolver, 0, false);
+
+    const double seconds = timer.Seconds();
+
+    if (options.m_Energy) ReportEnergy(energy, MergeStats(contexts));
+
+    WriteImage(framebuffer, "outputs/image.ppm");
+
+    std::cout << "Checkerboard: " << resolver.m_Interpolated << " of " << framebuffer.m_Width * framebuffer.m_Height << " pixels reconstructed, "
+              << MergeStats(contexts).TotalRays() << " rays, rendered in " << std::fixed << std::setprecision(2) << seconds * 1e3 << " ms.\n";
+
+    return 0;
+}
+
+// The guides of every pixel from a primary ray through its center, and no
+// shading: what upscaling needs at full resolution.
+//
+void TraceGuides(const Scene& scene, GuideBuffer& guides, ThreadContexts& contexts)
+{
+    TraceScope trace("guides");
+
+    contexts.resize(ThreadCount());
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int j = 0; j < guides.m_Height; j++) {
+        ThreadContext& context = contexts[ThreadIndex()];
+
+        for (int i = 0; i < guides.m_Width; i++) {
+            const Vec3f direction = PrimaryDirection<float>(i, j, guides.m_Width, guides.m_Height);
+            Hit hitInfo = Hit();
+
+            context.m_Stats.m_PrimaryRays++;
+            guides(i, j) = PixelGuide();
+
+            if (SceneIntersect(scene.m_Eye, direction, scene, hitInfo, context)) RecordGuide(scene.m_Eye, hitInfo, guides(i, j));
+        }
+    }
+}
+
+// Shading at 1 / --upscale of the resolution: primary rays alone are traced
+// at full resolution, for the guides that upsample the shaded image; pixels
+// no low resolution sample fits are then traced in full.
+//
+int RenderUpscaled(const Scene& scene, const Options& options)
+{
+    const int factor = options.m_Upscale;
+    Framebuffer framebuffer(1024, 768), low(framebuffer.m_Width / factor, framebuffer.m_Height / factor);
+    GuideBuffer guides(framebuffer.m_Width, framebuffer.m_Height), lowGuides(low.m_Width, low.m_Height);
+    RenderRegion fallback(Tile(0, 0, framebuffer.m_Width, framebuffer.m_Height));
+    ThreadContexts contexts, lowContexts;
+    const float halfFovTangent = (float)HalfFovTangent();
+    EnergyMeter energy;
+    Timer timer;
+
+    Render(scene, options, low, lowContexts, NULL, NULL, NULL, NULL, &lowGuides);
+    TraceGuides(scene.Placed(), guides, contexts);
+
+    size_t missing;
+    {
+        TraceScope trace("upsample");
+
+        missing = UpsampleGuided(low, lowGuides, PinholeCamera(scene.m_Eye, low.m_Width, low.m_Height, halfFovTangent),
+                                 guides, PinholeCamera(scene.m_Eye, framebuffer.m_Width, framebuffer.m_Height, halfFovTangent), factor, framebuffer, fallback);
+    }
+
+    if (missing) Render(scene, options, framebuffer, contexts, NULL, &fallback);
+
+    const double seconds = timer.Seconds();
+    RenderStats stats = MergeStats(lowContexts);
+
+    stats += MergeStats(contexts);
+
+    if (options.m_Energy) ReportEnergy(energy, stats);
+
+    WriteImage(framebuffer, "outputs/image.ppm");
+
+    std::cout << "Upscale: " << low.m_Width << "x" << low.m_Height << " shaded, " << missing << " pixels traced in full, "
+              << stats.TotalRays() << " rays, rendered in "
+              << std::fixed << std::setprecision(2) << seconds * 1e3 << " ms.\n";
+
+    return 0;
+}
+
+// --diff: how far two images are apart, e.g. a checkerboard or foveated
+// render and the full one, with a map of where they differ.
+//
+int DiffImages(const Options& options)
+{
+    const int threshold = 4;
+    PnmImage images[2], map;
+    ImageDifference difference;
+
+    for (int k = 0; k < 2; k++) {
+        if (!ReadPnm(options.m_Diff[k], images[k]))
+        {
+            std::cerr << "Cannot read a binary PGM/PPM image from \"" << options.m_Diff[k] << "\".\n";
+            return 1;
+        }
+    }
+
+    if (!CompareImages(images[0], images[1], threshold, difference, &map))
+    {
+        std::cerr << "The images differ in size or channels.\n";
+        return 1;
+    }
+
+    WritePnm("outputs/diff.pgm", map);
+
+    std::cout << std::fixed << std::setprecision(3) << "RMSE " << difference.m_Rmse << " (8-bit steps), PSNR " << std::setprecision(2) << difference.m_Psnr
+              << " dB, largest error " << difference.m_MaxError << ", " << 100.0 * difference.m_Differing << "% of pixels off by more than "
+              << threshold << ". Error map (x8): outputs/diff.pgm.\n";
+
+    return 0;
+}
+
+// Irradiance at a surface point, in the units of Bake.h: direct light from
+// ShadeLights, with the shadow rays of the renderer, plus the light CastRay
+// brings back along cosine-distributed directions (whose average is the
+// indirect irradiance, as the pdf cancels the cosine).
+//
+Vec3f BakeIrradiance(const Vec3f& point, const Vec3f& normal, const Scene& scene, const LightSet& lights, int samples, ThreadContext& context)
+{
+    Hit surface;
+    surface.point = point;
+    surface.normal = normal;
+
+    float direct = 0.0f, specular = 0.0f;
+
+    ShadeLights(surface, -normal, scene, lights, context, direct, specular);
+
+    Vec3f indirect;
+
+    for (int s = 0; s < samples; s++) {
+        float u1, u2;
+        StratifiedSample(s, samples, context.m_Random.NextFloat(), context.m_Random.NextFloat(), u1, u2);
+
+        Vec3f direction = SampleCosineHemisphere(normal, u1, u2);
+
+        indirect = indirect + CastRay(OffsetOrigin(point, normal, direction), direction, scene, lights, context, 1);
+    }
+
+    return Vec3f(direct, direct, direct) + indirect * (1.0f / samples);
+}
+
+// Fills "lightmap" from texel(i, j, normal) -> point, rows spread over the
+// threads. Each texel seeds the generator from (surface, i, j).
+//
+template <typename Texel> void BakeLightmap(Framebuffer& lightmap, int surface, Texel texel, const Scene& scene, const LightSet& lights,
+                                            int samples, ThreadContexts& contexts)
+{
+    const int height = lightmap.m_Height;
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int j = 0; j < height; j++) {
+        ThreadContext& context = contexts[ThreadIndex()];
+        TraceScope trace("bake row", j);
+
+        for (int i = 0; i < lightmap.m_Width; i++) {
+            Vec3f normal;
+            Vec3f point = texel(i, j, normal);
+
+            context.m_Random = Random(HashSeed(surface, i, j));
+            lightmap(i, j) = BakeIrradiance(point, normal, scene, lights, samples, context);
+        }
+    }
+}
+
+// Each probe gathers radiance from stratified directions over the sphere
+// with CastRay and keeps it as irradiance SH coefficients, one row each.
+// Lights are not seen by rays, so the direct light of each one the probe
+// sees is added as a delta from its center: radiance whose diffuse term is
+// its intensity times the cosine. Area lights count as points here, as their
+// intensity is spread to give the same light from afar.
+//
+void BakeProbes(Framebuffer& coefficients, const ProbeGrid& grid, const Scene& scene, const LightSet& lights, int samples, ThreadContexts& contexts)
+{
+    const int count = (int)grid.Count(); // At most MaxProbeGrid^3.
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int p = 0; p < count; p++) {
+        ThreadContext& context = contexts[ThreadIndex()];
+        TraceScope trace("bake probe", p);
+
+        const Vec3f position = grid.Position(p);
+        Vec3f sums[ShCoefficients], direct[ShCoefficients];
+        float basis[ShCoefficients];
+
+        if (grid.m_Inside[p])
+        {
+            for (int c = 0; c < ShCoefficients; c++) coefficients(c, p) = Vec3f();
+            continue;
+        }
+
+        for (size_t l = 0; l < scene.m_Lights.size(); l++) {
+            const Light& light = scene.m_Lights[l];
+            Vec3f toLight = light.m_Position - position;
+            const float distance = toLight.norm();
+
+            if (distance <= light.m_Radius) continue;
+
+            toLight = toLight * (1.0f / distance);
+            context.m_Stats.m_ShadowRays++;
+
+            if (SceneOccluded(position, toLight, distance - light.m_Radius, scene, context.m_Stats)) continue;
+
+            ShBasis(toLight, basis);
+
+            for (int c = 0; c < ShCoefficients; c++) direct[c] = direct[c] + Vec3f(1.0f, 1.0f, 1.0f) * (Pi * light.m_Intensity * basis[c]);
+        }
+
+        context.m_Random = Random(HashSeed(p, 0, 1));
+
+        for (int s = 0; s < samples; s++) {
+            float u1, u2;
+            StratifiedSample(s, samples, context.m_Random.NextFloat(), context.m_Random.NextFloat(), u1, u2);
+
+            Vec3f direction = SampleSphere(u1, u2);
+            Vec3f radiance = CastRay(position, direction, scene, lights, context);
+
+            ShBasis(direction, basis);
+
+            for (int c = 0; c < ShCoefficients; c++) sums[c] = sums[c] + radiance * basis[c];
+        }
+
+        for (int c = 0; c < ShCoefficients; c++) coefficients(c, p) = (sums[c] * (4.0f * Pi / samples) + direct[c]) * ShIrradianceFactor(c);
+    }
+}
+
+// Lightmaps of the checkerboard and of every sphere, then the probe grid,
+// all written to outputs/ as float textures.
+//
+int Bake(const Scene& scene, const Options& options)
+{
+    const LightSet lights(scene.m_Lights);
+    const int size = options.m_BakeSize, samples = options.m_BakeSamples;
+    ThreadContexts contexts(ThreadCount());
+    Timer timer;
+    bool written = true;
+
+    for (size_t i = 0; i < contexts.size(); i++) {
+        contexts[i].m_LightSamples = options.m_LightSamples;
+        contexts[i].m_Heuristic = options.m_Heuristic;
+    }
+
+    if (scene.m_Checkerboard.m_Enabled)
+    {
+        Framebuffer lightmap(size, size);
+
+        BakeLightmap(lightmap, 0, [&](int i, int j, Vec3f& normal) {
+            normal = Vec3f(0.0f, 1.0f, 0.0f);
+            return PlaneTexel(scene.m_Checkerboard, i, j, size, size);
+        }, scene, lights, samples, contexts);
+
+        written &= WritePfm(lightmap, "outputs/lightmap-plane.pfm");
+    }
+
+    // Spheres get half the rows, so their texels are about square.
+    for (size_t k = 0; k < scene.m_Spheres.size(); k++) {
+        const Sphere& sphere = scene.m_Spheres[k];
+        Framebuffer lightmap(size, std::max(1, size / 2));
+
+        BakeLightmap(lightmap, (int)k + 1, [&](int i, int j, Vec3f& normal) {
+            normal = SphereTexel(i, j, lightmap.m_Width, lightmap.m_Height);
+            return sphere.m_Center + normal * sphere.m_Radius;
+        }, scene, lights, samples, contexts);
+
+        std::ostringstream path;
+        path << "outputs/lightmap-sphere-" << k << ".pfm";
+
+        written &= WritePfm(lightmap, path.str().c_str());
+    }
+
+    const double lightmapSeconds = timer.Seconds();
+    const ProbeGrid grid(scene, options.m_ProbeGrid);
+    Framebuffer coefficients(ShCoefficients, (int)grid.Count());
+
+    timer.Reset();
+    BakeProbes(coefficients, grid, scene, lights, 4 * samples, contexts);
+
+    written &= WritePfm(coefficients, "outputs/probes.pfm");
+    written &= grid.Write("outputs/probes.txt", "probes.pfm");
+
+    const RenderStats stats = MergeStats(contexts);
+
+    std::cout << std::fixed << std::setprecision(2) << "Baked " << (scene.m_Checkerboard.m_Enabled ? 1 : 0) + scene.m_Spheres.size() << " lightmaps ("
+              << size << " texels wide, " << samples << " bounce samples) in " << lightmapSeconds << " s and " << grid.Count() << " probes ("
+              << 4 * samples << " samples, " << grid.InsideCount() << " inside spheres and left black) in " << timer.Seconds() << " s; "
+              << stats.TotalRays() << " rays.\n";
+
+    if (!written)
+    {
+        std::cerr << "Cannot write the baked textures to outputs/.\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+// The benchmark or render asked for by the options; returns the exit code.
+int Run(const Scene& scene, const Options& options, const PerfSample& buildEvents)
+{
+    if (options.m_BenchScaling)
+    {
+        BenchScaling(scene, options, buildEvents);
+
+        return 0;
+    }
+
+    if (options.m_PerfCheck) return PerfCheck(scene, options, buildEvents);
+
+    if (options.m_BenchIntersect)
+    {
+        BenchIntersect(scene.Placed(), options);
+
+        return 0;
+    }
+
+    if (options.m_BenchPrecision)
+    {
+        BenchPrecision(scene, options);
+
+        return 0;
+    }
+
+    if (options.m_Diff[0]) return DiffImages(options);
+
+    if (options.m_Bake) return Bake(scene.Placed(), options);
+
+    if (options.m_Crop || options.m_Mask) return RenderPartial(scene, options);
+
+    if (options.m_Checkpoint) return RenderCheckpointed(scene, options);
+
+    if (options.m_Stream) return StreamFrames(scene, options);
+
+    if (options.m_Shm) return RenderShared(scene, options);
+
+    if (options.m_Frames > 1) return RenderFrames(scene, options);
+
+    if (options.m_Focus || options.m_Importance) return RenderFoveated(scene, options);
+
+    if (options.m_Checkerboard) return RenderCheckerboardImage(scene, options);
+
+    if (options.m_Upscale > 1) return RenderUpscaled(scene, options);
+
+    Framebuffer framebuffer(1024, 768);
+    ThreadContexts contexts;
+
+    if (options.m_Heatmap)
+    {
+        CostMap costs(framebuffer.m_Width, framebuffer.m_Height);
+        EnergyMeter energy;
+
+        Render(scene, options, framebuffer, contexts, &costs);
+
+        if (options.m_Energy) ReportEnergy(energy, MergeStats(contexts));
+
+        WriteImage(framebuffer, "outputs/image.ppm");
+        WriteHeatmaps(costs);
+
+        return 0;
+    }
+
+    PerfSample outputEvents;
+    EnergyMeter energy;
+
+    Render(scene, options, framebuffer, contexts);
+
+    if (options.m_Energy) ReportEnergy(energy, MergeStats(contexts));
+
+    CountEvents(options.m_PerfCounters, outputEvents, [&]() { WriteImage(framebuffer, "outputs/image.ppm"); });
+
+    if (options.m_PerfCounters) ReportPerfCounters(contexts, &buildEvents, &outputEvents);
+
+    return 0;
+}
+
+// The x64 Visual Studio configurations build with /arch:AVX2, as do
+// -march builds on AVX2 machines; the SIMD paths then need it at run time.
+//
+bool CpuRunsBuild()
+{
+#if defined(__AVX2__) && defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+
+    __cpuid(info, 1);
+    const bool fma = (info[2] & (1 << 12)) != 0, osxsave = (info[2] & (1 << 27)) != 0;
+
+    __cpuidex(info, 7, 0);
+    const bool avx2 = (info[1] & (1 << 5)) != 0;
+
+    // The OS must save the YMM registers too.
+    return fma && avx2 && osxsave && (_xgetbv(0) & 6) == 6;
+#elif defined(__AVX2__)
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return true;
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    if (!CpuRunsBuild())
+    {
+        std::cerr << "This build uses AVX2 and FMA, which the CPU does not support; use the Win32 configuration or build without them.\n";
+        return 1;
+    }
+
+    if (!ParseOptions(argc, argv, options)) return 1;
+
+    // Reports go to stderr when the frames take stdout.
+    if (options.m_Stream && !strcmp(options.m_Stream, "-")) std::cout.rdbuf(std::cerr.rdbuf());
+
+    SetThreadCount(options.m_Threads);
+
+    if (options.m_Trace) TraceRecorder::Get().Enable(ThreadCount(), TraceCapacity);
+
+    Timer generateTimer;
+    Scene scene;
+    PerfSample buildEvents;
+
+    CountEvents(options.m_PerfCounters, buildEvents, [&]() {
+        TraceScope trace("scene build");
+
+        scene = GenerateScene(options.m_Scene, options.m_SceneSize, options.m_Seed, MaterialPalette(options.m_Microfacet));
+    });
+
+    if (options.m_Scene != DefaultScene)
+    {
+        std::cout << "Scene: " << scene.m_Spheres.size() << " spheres, " << scene.m_Lights.size() << " lights, generated in "
+                  << std::fixed << std::setprecision(2) << generateTimer.Seconds() * 1e3 << " ms.\n";
+    }
+
+    std::vector<Light>& lights = scene.m_Lights;
+
+    for (size_t i = 0; i < lights.size(); i++) lights[i].m_Radius = options.m_LightRadius;
+
+    scene.m_WorldOffset = Vec3d(options.m_WorldOffset, options.m_WorldOffset, options.m_WorldOffset);
+
+    int status = Run(scene, options, buildEvents);
+
+    if (options.m_Trace && !TraceRecorder::Get().Write(options.m_Trace))
+    {
+        std::cerr << "Cannot write \"" << options.m_Trace << "\".\n";
+        status = 1;
+    }
+
+    return status;
+}
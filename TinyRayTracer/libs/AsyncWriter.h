@@ -0,0 +1,440 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+enum OutputBackend
+{
+	OutputSync,    // Written on the calling thread, as WriteImage does.
+	OutputThreads, // Worker threads with blocking writes.
+	OutputUring,   // Linux io_uring; falls back to threads where it is missing.
+};
+
+inline const char* OutputBackendName(OutputBackend backend)
+{
+	return backend == OutputSync ? "sync" : backend == OutputThreads ? "threads" : "io_uring";
+}
+
+// A whole file to write.
+struct OutputJob
+{
+	std::string m_Path;
+	std::string m_Bytes;
+	int m_Fd;         // io_uring only: -1 while the file is being opened.
+	size_t m_Written; // io_uring only: bytes done, short writes are resubmitted.
+};
+
+struct OutputStats
+{
+	int m_Files;
+	int m_Failed;
+	uint64_t m_Bytes;
+	double m_Busy;  // Seconds during which at least one write was in flight.
+	double m_Stall; // Seconds the caller waited, in Write() or Finish().
+
+	OutputStats() : m_Files(0), m_Failed(0), m_Bytes(0), m_Busy(0.0), m_Stall(0.0) {}
+
+	// Share of the output time hidden behind the caller's work.
+	double Overlap() const { return m_Busy > 0.0 ? std::max(0.0, 1.0 - m_Stall / m_Busy) : 0.0; }
+};
+
+#if defined(__linux__)
+// Just enough of io_uring, through the raw system calls: one submission and
+// one completion ring, mapped as the kernel lays them out. The caller
+// serializes submissions; completions are consumed by a single thread.
+//
+struct Uring
+{
+	int m_Fd;
+	void* m_Rings[3]; // Submission ring, completion ring, entries.
+	size_t m_Sizes[3];
+
+	unsigned* m_SqHead;
+	unsigned* m_SqTail;
+	unsigned m_SqMask;
+	unsigned* m_SqArray;
+	io_uring_sqe* m_Sqes;
+
+	unsigned* m_CqHead;
+	unsigned* m_CqTail;
+	unsigned m_CqMask;
+	io_uring_cqe* m_Cqes;
+
+	Uring() : m_Fd(-1)
+	{
+		for (int k = 0; k < 3; k++) m_Rings[k] = MAP_FAILED;
+	}
+
+	~Uring()
+	{
+		for (int k = 0; k < 3; k++) {
+			if (m_Rings[k] != MAP_FAILED) munmap(m_Rings[k], m_Sizes[k]);
+		}
+
+		if (m_Fd >= 0) close(m_Fd);
+	}
+
+	bool Setup(unsigned entries)
+	{
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+
+		m_Fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+
+		if (m_Fd < 0) return false;
+
+		m_Sizes[0] = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_Sizes[1] = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		m_Sizes[2] = params.sq_entries * sizeof(io_uring_sqe);
+
+		const off_t offsets[3] = { IORING_OFF_SQ_RING, IORING_OFF_CQ_RING, IORING_OFF_SQES };
+
+		for (int k = 0; k < 3; k++) {
+			m_Rings[k] = mmap(NULL, m_Sizes[k], PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, offsets[k]);
+
+			if (m_Rings[k] == MAP_FAILED) return false;
+		}
+
+		char* sq = static_cast<char*>(m_Rings[0]);
+		char* cq = static_cast<char*>(m_Rings[1]);
+
+		m_SqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+		m_SqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		m_SqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		m_SqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+		m_Sqes = static_cast<io_uring_sqe*>(m_Rings[2]);
+
+		m_CqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		m_CqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		m_CqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		m_Cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+		return true;
+	}
+
+	// Whether the kernel implements every one of "opcodes". Rings exist since
+	// 5.1, but openat and write only since 5.6, like the probe itself: an
+	// older kernel refuses the probe and counts as lacking them.
+	//
+	bool Supports(const uint8_t* opcodes, int count) const
+	{
+		const unsigned entries = 256;
+		std::vector<char> buffer(sizeof(io_uring_probe) + entries * sizeof(io_uring_probe_op), 0);
+		io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+
+		if (syscall(__NR_io_uring_register, m_Fd, IORING_REGISTER_PROBE, probe, entries) < 0) return false;
+
+		for (int k = 0; k < count; k++) {
+			if (opcodes[k] > probe->last_op || !(probe->ops[opcodes[k]].flags & IO_URING_OP_SUPPORTED)) return false;
+		}
+
+		return true;
+	}
+
+	// Queues one operation and tells the kernel. The ring is never fuller
+	// than the writer's depth, which is below its size.
+	//
+	// Only io_uring_enter takes entries off the ring. If it fails before
+	// taking this one, the entry is withdrawn, as the caller frees what it
+	// points to; one the kernel took will complete like any other.
+	//
+	bool Submit(uint8_t opcode, int fd, const void* data, unsigned length, uint64_t offset, uint32_t flags, void* user)
+	{
+		unsigned tail = *m_SqTail, index = tail & m_SqMask;
+		io_uring_sqe& sqe = m_Sqes[index];
+
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = opcode;
+		sqe.fd = fd;
+		sqe.addr = (uint64_t)(uintptr_t)data;
+		sqe.len = length;
+		sqe.off = offset;
+		sqe.open_flags = flags;
+		sqe.user_data = (uint64_t)(uintptr_t)user;
+
+		m_SqArray[index] = index;
+		__atomic_store_n(m_SqTail, tail + 1, __ATOMIC_RELEASE);
+
+		long submitted;
+
+		do submitted = syscall(__NR_io_uring_enter, m_Fd, 1, 0, 0, NULL, 0);
+		while (submitted < 0 && errno == EINTR);
+
+		if (submitted == 1 || __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE) != tail) return true;
+
+		__atomic_store_n(m_SqTail, tail, __ATOMIC_RELEASE);
+
+		return false;
+	}
+
+	// Blocks for the next completion.
+	bool Wait(io_uring_cqe& cqe)
+	{
+		for (;;) {
+			unsigned head = *m_CqHead;
+
+			if (head != __atomic_load_n(m_CqTail, __ATOMIC_ACQUIRE))
+			{
+				cqe = m_Cqes[head & m_CqMask];
+				__atomic_store_n(m_CqHead, head + 1, __ATOMIC_RELEASE);
+
+				return true;
+			}
+
+			if (syscall(__NR_io_uring_enter, m_Fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) return false;
+		}
+	}
+};
+#endif
+
+// Writes whole files in the background while the caller goes on, e.g. with
+// the next frame. At most "depth" files are in flight; Write() blocks while
+// the queue is full, so a slow disk holds back the renderer instead of
+// filling memory with encoded frames.
+//
+struct AsyncWriter
+{
+	OutputBackend m_Backend; // The one in use, after any fallback.
+	int m_Depth;
+	OutputStats m_Stats;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Changed;
+	std::deque<OutputJob*> m_Queue; // Threads only: jobs not yet taken.
+	int m_InFlight;
+	bool m_Stopping;
+	std::chrono::steady_clock::time_point m_BusySince;
+	std::vector<std::thread> m_Threads;
+
+#if defined(__linux__)
+	Uring m_Uring;
+#endif
+
+	AsyncWriter(OutputBackend backend, int depth, int threads = 2)
+		: m_Backend(backend), m_Depth(std::max(1, depth)), m_InFlight(0), m_Stopping(false)
+	{
+#if defined(__linux__)
+		const uint8_t opcodes[] = { IORING_OP_NOP, IORING_OP_OPENAT, IORING_OP_WRITE };
+
+		if (m_Backend == OutputUring && m_Uring.Setup(2 * m_Depth) && m_Uring.Supports(opcodes, 3)) m_Threads.push_back(std::thread([this]() { ReapUring(); }));
+		else if (m_Backend == OutputUring) m_Backend = OutputThreads;
+#else
+		if (m_Backend == OutputUring) m_Backend = OutputThreads;
+#endif
+
+		if (m_Backend == OutputThreads)
+		{
+			for (int t = 0; t < threads; t++) m_Threads.push_back(std::thread([this]() { RunWorker(); }));
+		}
+	}
+
+	~AsyncWriter()
+	{
+		Finish();
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stopping = true;
+		}
+
+		m_Changed.notify_all();
+
+#if defined(__linux__)
+		// The reaper sleeps in the kernel; a no-op without a job wakes it up.
+		if (m_Backend == OutputUring)
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Uring.Submit(IORING_OP_NOP, -1, NULL, 0, 0, 0, NULL);
+		}
+#endif
+
+		for (size_t t = 0; t < m_Threads.size(); t++) m_Threads[t].join();
+	}
+
+	void Write(const std::string& path, std::string&& bytes)
+	{
+		OutputJob* job = new OutputJob();
+
+		job->m_Path = path;
+		job->m_Bytes.swap(bytes);
+		job->m_Fd = -1;
+		job->m_Written = 0;
+
+		if (m_Backend == OutputSync)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			bool ok = WriteFile(*job);
+			double seconds = Seconds(start);
+
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			Count(*job, ok);
+			m_Stats.m_Busy += seconds;
+			m_Stats.m_Stall += seconds;
+			delete job;
+
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(m_Mutex);
+
+		WaitWhile(lock, m_Depth);
+
+		if (m_InFlight++ == 0) m_BusySince = std::chrono::steady_clock::now();
+
+		if (m_Backend == OutputThreads)
+		{
+			m_Queue.push_back(job);
+			lock.unlock();
+			m_Changed.notify_all();
+		}
+#if defined(__linux__)
+		else
+		{
+			// Opening can block too (a pipe without a reader), so it is queued
+			// like the write, which the reaper submits once the file is open.
+			const uint32_t flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+			if (!m_Uring.Submit(IORING_OP_OPENAT, AT_FDCWD, job->m_Path.c_str(), 0644, 0, flags, job)) Complete(job, false);
+		}
+#endif
+	}
+
+	// Waits for every write to complete.
+	void Finish()
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+
+		WaitWhile(lock, 1);
+	}
+
+	// Blocks while "limit" or more writes are in flight; the time counts as stall.
+	void WaitWhile(std::unique_lock<std::mutex>& lock, int limit)
+	{
+		if (m_InFlight < limit) return;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		while (m_InFlight >= limit) m_Changed.wait(lock);
+
+		m_Stats.m_Stall += Seconds(start);
+	}
+
+	// With m_Mutex held.
+	void Complete(OutputJob* job, bool ok)
+	{
+		Count(*job, ok);
+
+		if (--m_InFlight == 0) m_Stats.m_Busy += Seconds(m_BusySince);
+
+		delete job;
+		m_Changed.notify_all();
+	}
+
+	void Count(const OutputJob& job, bool ok)
+	{
+		m_Stats.m_Files++;
+		m_Stats.m_Failed += !ok;
+		m_Stats.m_Bytes += ok ? job.m_Bytes.size() : 0;
+	}
+
+	void RunWorker()
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+
+		for (;;) {
+			while (m_Queue.empty() && !m_Stopping) m_Changed.wait(lock);
+
+			if (m_Queue.empty()) return;
+
+			OutputJob* job = m_Queue.front();
+			m_Queue.pop_front();
+
+			lock.unlock();
+			bool ok = WriteFile(*job);
+			lock.lock();
+
+			Complete(job, ok);
+		}
+	}
+
+#if defined(__linux__)
+	// Writes the rest of the job from where the last completion left it.
+	bool SubmitUring(OutputJob& job)
+	{
+		const size_t chunk = std::min(job.m_Bytes.size() - job.m_Written, size_t(1) << 30);
+
+		return m_Uring.Submit(IORING_OP_WRITE, job.m_Fd, job.m_Bytes.data() + job.m_Written, (unsigned)chunk, job.m_Written, 0, &job);
+	}
+
+	void ReapUring()
+	{
+		io_uring_cqe cqe;
+
+		while (m_Uring.Wait(cqe)) {
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			OutputJob* job = reinterpret_cast<OutputJob*>((uintptr_t)cqe.user_data);
+
+			if (!job)
+			{
+				if (m_Stopping) return;
+				continue;
+			}
+
+			if (job->m_Fd < 0 && cqe.res < 0)
+			{
+				Complete(job, false);
+				continue;
+			}
+
+			// An open completes with the descriptor, a write with the bytes it took.
+			bool failed = false;
+
+			if (job->m_Fd < 0) job->m_Fd = cqe.res;
+			else if (cqe.res > 0) job->m_Written += cqe.res;
+			else failed = true;
+
+			if (!failed && job->m_Written < job->m_Bytes.size() && SubmitUring(*job)) continue;
+
+			const bool ok = !failed && job->m_Written == job->m_Bytes.size();
+
+			close(job->m_Fd);
+			Complete(job, ok);
+		}
+	}
+#endif
+
+	static bool WriteFile(const OutputJob& job)
+	{
+		std::ofstream ofs(job.m_Path.c_str(), std::ofstream::out | std::ofstream::binary);
+		ofs.write(job.m_Bytes.data(), job.m_Bytes.size());
+
+		return ofs.good();
+	}
+
+	static double Seconds(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+private:
+	AsyncWriter(const AsyncWriter&);
+	AsyncWriter& operator=(const AsyncWriter&);
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#include "Geometry.h"
+#include "Sphere.h"
+#include "Scene.h"
+#include "Sampling.h"
+#include "Framebuffer.h"
+
+// Lighting baked for a real-time engine. Values are in the units of the
+// diffuse term of Shade: a surface of diffuse color C and albedo a shows
+// C * a * irradiance. Textures are framebuffers written as PFM files.
+//
+
+// Portable float map: little-endian RGB floats, rows from the bottom up.
+inline bool WritePfm(const Framebuffer& image, const char* path)
+{
+	std::ofstream ofs(path, std::ofstream::out | std::ofstream::binary);
+
+	ofs << "PF\n" << image.m_Width << " " << image.m_Height << "\n-1.0\n";
+
+	for (int j = image.m_Height - 1; j >= 0; j--) {
+		ofs.write(reinterpret_cast<const char*>(&image(0, j)), image.m_Width * sizeof(Vec3f));
+	}
+
+	return ofs.good();
+}
+
+// Lightmap texel (i, j) of the checkerboard: u runs along x, v along z from
+// the far edge (z = -30) to the near one.
+//
+inline Vec3f PlaneTexel(const Checkerboard& checkerboard, int i, int j, int width, int height)
+{
+	float u = (i + 0.5f) / width, v = (j + 0.5f) / height;
+
+	return checkerboard.m_Offset + Vec3f(-10.0f + 20.0f * u, -4.0f, -30.0f + 20.0f * v);
+}
+
+// Latitude-longitude texel (i, j) of a sphere: u is the angle around y, v
+// the angle from +y. Returns the normal; the point is center + radius * normal.
+//
+inline Vec3f SphereTexel(int i, int j, int width, int height)
+{
+	float phi = 2.0f * Pi * (i + 0.5f) / width, theta = Pi * (j + 0.5f) / height;
+
+	return Vec3f(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+}
+
+// Real spherical harmonics up to band 2, in the usual order
+// (0,0), (1,-1), (1,0), (1,1), (2,-2), (2,-1), (2,0), (2,1), (2,2).
+const int ShCoefficients = 9;
+
+inline void ShBasis(const Vec3f& d, float* basis)
+{
+	basis[0] = 0.282095f;
+	basis[1] = 0.488603f * d.y;
+	basis[2] = 0.488603f * d.z;
+	basis[3] = 0.488603f * d.x;
+	basis[4] = 1.092548f * d.x * d.y;
+	basis[5] = 1.092548f * d.y * d.z;
+	basis[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+	basis[7] = 1.092548f * d.x * d.z;
+	basis[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+}
+
+// Band factors turning projected radiance into irradiance (Ramamoorthi and
+// Hanrahan's pi, 2 pi / 3, pi / 4), divided by pi for the units above.
+inline float ShIrradianceFactor(int coefficient)
+{
+	return coefficient == 0 ? 1.0f : coefficient < 4 ? 2.0f / 3.0f : 0.25f;
+}
+
+// Largest --probe-grid: 256^3 probes of 9 RGB coefficients take 1.8 GB.
+const int MaxProbeGrid = 256;
+
+// Probes at the centers of an n x n x n grid of cells over the scene bounds.
+// A probe inside a sphere would only see its inside, so it is flagged and
+// left black for the engine to skip.
+//
+struct ProbeGrid
+{
+	Vec3f m_Origin;  // Corner of the bounds.
+	Vec3f m_Spacing; // Size of a cell.
+	int m_Size;
+	std::vector<uint8_t> m_Inside; // Per probe: its center lies inside a sphere.
+
+	ProbeGrid(const Scene& scene, int size) : m_Size(std::min(std::max(1, size), MaxProbeGrid))
+	{
+		const Vec3f& offset = scene.m_Checkerboard.m_Offset;
+		Vec3f low = offset + Vec3f(-10.0f, -4.0f, -30.0f), high = offset + Vec3f(10.0f, -4.0f, -10.0f);
+
+		for (size_t i = 0; i < scene.m_Spheres.size(); i++) {
+			const Sphere& sphere = scene.m_Spheres[i];
+
+			for (int k = 0; k < 3; k++) {
+				low[k] = std::min(low[k], sphere.m_Center[k] - sphere.m_Radius);
+				high[k] = std::max(high[k], sphere.m_Center[k] + sphere.m_Radius);
+			}
+		}
+
+		m_Origin = low;
+		m_Spacing = (high - low) * (1.0f / m_Size);
+		m_Inside.assign(Count(), 0);
+
+		for (size_t p = 0; p < Count(); p++) {
+			const Vec3f position = Position(p);
+
+			for (size_t i = 0; i < scene.m_Spheres.size() && !m_Inside[p]; i++) {
+				const Vec3f toCenter = scene.m_Spheres[i].m_Center - position;
+
+				m_Inside[p] = toCenter * toCenter < scene.m_Spheres[i].m_Radius * scene.m_Spheres[i].m_Radius;
+			}
+		}
+	}
+
+	int InsideCount() const { return (int)std::count(m_Inside.begin(), m_Inside.end(), 1); }
+
+	size_t Count() const { return size_t(m_Size) * m_Size * m_Size; }
+
+	// Probe "index" is x + size * (y + size * z).
+	Vec3f Position(size_t index) const
+	{
+		size_t x = index % m_Size, y = index / m_Size % m_Size, z = index / (size_t(m_Size) * m_Size);
+
+		return m_Origin + Vec3f((x + 0.5f) * m_Spacing.x, (y + 0.5f) * m_Spacing.y, (z + 0.5f) * m_Spacing.z);
+	}
+
+	// Grid description for the engine, next to the coefficient texture.
+	bool Write(const char* path, const char* texture) const
+	{
+		std::ofstream ofs(path);
+
+		ofs << "# Irradiance probes: " << ShCoefficients << " RGB SH coefficients per probe, one probe per row of " << texture << ".\n"
+		    << "# Row = x + size * (y + size * z); probe position = origin + (index + 0.5) * spacing.\n"
+		    << "size " << m_Size << "\n"
+		    << "origin " << m_Origin.x << " " << m_Origin.y << " " << m_Origin.z << "\n"
+		    << "spacing " << m_Spacing.x << " " << m_Spacing.y << " " << m_Spacing.z << "\n"
+		    << "# Rows of the probes inside a sphere, all zero: interpolate from the others.\n"
+		    << "inside " << InsideCount();
+
+		for (size_t p = 0; p < Count(); p++) {
+			if (m_Inside[p]) ofs << " " << p;
+		}
+
+		ofs << "\n";
+
+		return ofs.good();
+	}
+};
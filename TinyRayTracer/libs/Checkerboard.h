@@ -0,0 +1,229 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <vector>
+
+#include "Geometry.h"
+#include "Framebuffer.h"
+
+// What the primary ray of a pixel hit: its distance along the ray, infinite
+// on a miss, the surface normal and the Material::Id of the surface.
+// Checkerboard rendering and upscaling reconstruct pixels with these as
+// guides.
+//
+struct PixelGuide
+{
+	float m_Depth;
+	Vec3f m_Normal;
+	uint32_t m_Material;
+
+	PixelGuide() : m_Depth(std::numeric_limits<float>::infinity()), m_Normal(), m_Material(0) {}
+};
+
+struct GuideBuffer
+{
+	int m_Width;
+	int m_Height;
+	std::vector<PixelGuide> m_Guides;
+
+	GuideBuffer(int width, int height) : m_Width(width), m_Height(height), m_Guides(size_t(width) * height) {}
+
+	      PixelGuide& operator()(int i, int j)       { return m_Guides[i + size_t(j) * m_Width]; }
+	const PixelGuide& operator()(int i, int j) const { return m_Guides[i + size_t(j) * m_Width]; }
+};
+
+// How far apart two guides are: relative depth difference plus normal
+// divergence. Two misses agree; a miss and a hit are far apart.
+//
+inline float GuideDistance(const PixelGuide& a, const PixelGuide& b)
+{
+	const bool missA = std::isinf(a.m_Depth), missB = std::isinf(b.m_Depth);
+
+	if (missA || missB) return missA == missB ? 0.0f : 100.0f;
+
+	return std::fabs(a.m_Depth - b.m_Depth) / std::min(a.m_Depth, b.m_Depth) + (1.0f - a.m_Normal * b.m_Normal);
+}
+
+// The pinhole camera of PrimaryDirection, for pixel centers, and its inverse.
+struct PinholeCamera
+{
+	Vec3f m_Eye;
+	int m_Width;
+	int m_Height;
+	float m_HalfFovTangent;
+
+	PinholeCamera(const Vec3f& eye, int width, int height, float halfFovTangent)
+		: m_Eye(eye), m_Width(width), m_Height(height), m_HalfFovTangent(halfFovTangent) {}
+
+	Vec3f Direction(int i, int j) const
+	{
+		float x =  (2 * (i + 0.5f) / m_Width  - 1) * m_HalfFovTangent * m_Width / m_Height;
+		float y = -(2 * (j + 0.5f) / m_Height - 1) * m_HalfFovTangent;
+
+		return Vec3f(x, y, -1).normalize();
+	}
+
+	// Image position (x, y) of "point", pixel (i, j) covering [i, i + 1) x [j, j + 1);
+	// false behind the camera or off the frame.
+	bool Project(const Vec3f& point, float& x, float& y) const
+	{
+		Vec3f d = point - m_Eye;
+
+		if (d.z >= 0) return false;
+
+		x = (d.x / -d.z / (m_HalfFovTangent * m_Width / m_Height) + 1) * 0.5f * m_Width;
+		y = (1 - d.y / -d.z / m_HalfFovTangent) * 0.5f * m_Height;
+
+		return x >= 0 && x < m_Width && y >= 0 && y < m_Height;
+	}
+};
+
+const float CheckerboardReuseDistance = 0.25f; // Largest offset to a reused sample, in pixels.
+const float CheckerboardGuideTolerance = 0.05f; // Largest GuideDistance to it.
+
+// Frames traced on alternating halves of a checkerboard: frame n traces the
+// pixels with (i + j + n) even. Resolve() fills in the others.
+//
+// Spatially, a skipped pixel takes its four traced neighbours, each weighted
+// by how well it agrees with the opposite neighbour in depth, normal and
+// color: across an edge, geometric or in a texture, the pair along the edge
+// wins and the edge stays sharp.
+//
+// Temporally, the pixel's point is placed at the interpolated depth along
+// its ray and projected into the previous frame. If it lands within a
+// quarter pixel of the center of a pixel traced there, not reconstructed,
+// and the guides agree, that sample is used, clamped to the range of the
+// four neighbours so that moving highlights and disocclusions cannot smear.
+// Otherwise the spatial estimate is kept. Reusing only traced samples keeps
+// errors from feeding back from frame to frame.
+//
+struct CheckerboardResolver
+{
+	Framebuffer m_History;   // Previous resolved frame,
+	GuideBuffer m_HistoryGuides;
+	Vec3f m_HistoryEye;      // and where it was seen from.
+	bool m_HasHistory;
+
+	int m_Reprojected;       // Skipped pixels filled from the history in the last frame.
+	int m_Interpolated;      // Filled from their neighbours.
+
+	CheckerboardResolver(int width, int height)
+		: m_History(width, height), m_HistoryGuides(width, height), m_HistoryEye(), m_HasHistory(false), m_Reprojected(0), m_Interpolated(0) {}
+
+	// "guides" holds those of the traced pixels and receives the others; it is
+	// kept as the history, and the buffer handed back holds stale guides that
+	// the next frame overwrites.
+	void Resolve(Framebuffer& framebuffer, GuideBuffer& guides, const PinholeCamera& camera, int frame, bool temporal)
+	{
+		const int width = framebuffer.m_Width, height = framebuffer.m_Height;
+		const PinholeCamera previous(m_HistoryEye, width, height, camera.m_HalfFovTangent);
+		const bool useHistory = temporal && m_HasHistory;
+		int reprojected = 0, interpolated = 0;
+
+		#pragma omp parallel for schedule(static) reduction(+ : reprojected, interpolated)
+		for (int j = 0; j < height; j++) {
+			for (int i = (j + frame + 1) & 1; i < width; i += 2) {
+				// Left, right, up, down; missing at the edges of the frame.
+				const int ni[4] = { i - 1, i + 1, i, i };
+				const int nj[4] = { j, j, j - 1, j + 1 };
+				bool valid[4];
+
+				for (int n = 0; n < 4; n++) valid[n] = ni[n] >= 0 && ni[n] < width && nj[n] >= 0 && nj[n] < height;
+
+				Vec3f sum, low(1e30f, 1e30f, 1e30f), high(-1e30f, -1e30f, -1e30f);
+				float weights = 0.0f, depth = 0.0f, depthWeights = 0.0f;
+				Vec3f normal;
+
+				for (int n = 0; n < 4; n++) {
+					if (!valid[n]) continue;
+
+					const int opposite = n ^ 1;
+					const PixelGuide& guide = guides(ni[n], nj[n]);
+					const Vec3f& color = framebuffer(ni[n], nj[n]);
+					float distance = 1.0f;
+
+					if (valid[opposite])
+					{
+						const Vec3f step = color - framebuffer(ni[opposite], nj[opposite]);
+
+						distance = GuideDistance(guide, guides(ni[opposite], nj[opposite])) + std::fabs(step.x) + std::fabs(step.y) + std::fabs(step.z);
+					}
+
+					const float weight = 1.0f / (0.01f + distance);
+
+					sum = sum + color * weight;
+					weights += weight;
+
+					for (int k = 0; k < 3; k++) {
+						low[k] = std::min(low[k], color[k]);
+						high[k] = std::max(high[k], color[k]);
+					}
+
+					if (!std::isinf(guide.m_Depth))
+					{
+						depth += guide.m_Depth * weight;
+						normal = normal + guide.m_Normal * weight;
+						depthWeights += weight;
+					}
+				}
+
+				// Most neighbours missed: the pixel counts as background.
+				PixelGuide& guide = guides(i, j);
+				guide = PixelGuide();
+
+				if (depthWeights > 0.5f * weights)
+				{
+					guide.m_Depth = depth / depthWeights;
+					guide.m_Normal = normal.normalize();
+				}
+
+				Vec3f color = sum * (1.0f / weights);
+				float x, y;
+
+				if (useHistory)
+				{
+					// Background lies at infinity, where only the direction matters.
+					const Vec3f direction = camera.Direction(i, j);
+					const bool miss = std::isinf(guide.m_Depth);
+					const Vec3f point = miss ? previous.m_Eye + direction : camera.m_Eye + direction * guide.m_Depth;
+
+					if (previous.Project(point, x, y))
+					{
+						// The previous frame traced the pixels with (i + j + frame + 1) even.
+						const int pi = (int)x, pj = (int)y;
+						const bool traced = ((pi + pj + frame + 1) & 1) == 0;
+						const bool close = std::fabs(x - pi - 0.5f) <= CheckerboardReuseDistance && std::fabs(y - pj - 0.5f) <= CheckerboardReuseDistance;
+						PixelGuide expected = guide;
+
+						if (!miss) expected.m_Depth = (point - previous.m_Eye).norm();
+
+						if (traced && close && GuideDistance(expected, m_HistoryGuides(pi, pj)) < CheckerboardGuideTolerance)
+						{
+							const Vec3f& history = m_History(pi, pj);
+
+							for (int k = 0; k < 3; k++) color[k] = std::min(high[k], std::max(low[k], history[k]));
+
+							reprojected++;
+							framebuffer(i, j) = color;
+							continue;
+						}
+					}
+				}
+
+				interpolated++;
+				framebuffer(i, j) = color;
+			}
+		}
+
+		m_Reprojected = reprojected;
+		m_Interpolated = interpolated;
+
+		m_History = framebuffer;
+		m_HistoryGuides.m_Guides.swap(guides.m_Guides);
+		m_HistoryEye = camera.m_Eye;
+		m_HasHistory = true;
+	}
+};
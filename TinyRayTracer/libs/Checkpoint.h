@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Geometry.h"
+#include "Framebuffer.h"
+
+// State of a render done in sample passes: the per-pixel sums of the samples
+// traced so far, not yet divided, and how many samples each pixel has. The
+// generator is reseeded from (pixel, sample) for every sample, so the counts
+// are the whole random state: a resumed render traces exactly the samples an
+// uninterrupted one would have, and adds them in the same order.
+//
+// A pass is rendered band by band, and saved between bands, so the pixels of
+// the bands done have one sample more than the others. A pixel with all its
+// samples already holds its final, divided color.
+//
+// On disk: a text line with the version, one with the settings the sums
+// depend on, one with "width height", then the counts as uint32 and the sums
+// as float RGB, row by row, in the byte order of the machine.
+//
+struct Checkpoint
+{
+	std::string m_Settings;    // A resume must be given the same settings.
+	int m_Width;
+	int m_Height;
+	std::vector<uint32_t> m_Samples;
+	std::vector<Vec3f> m_Sums; // Rows without the framebuffer padding.
+
+	Checkpoint() : m_Width(0), m_Height(0) {}
+
+	void Capture(const std::string& settings, const Framebuffer& sums, const std::vector<uint32_t>& samples)
+	{
+		m_Settings = settings;
+		m_Width = sums.m_Width;
+		m_Height = sums.m_Height;
+		m_Samples = samples;
+		m_Sums.resize(size_t(m_Width) * m_Height);
+
+		for (int j = 0; j < m_Height; j++) {
+			std::copy(&sums(0, j), &sums(0, j) + m_Width, &m_Sums[size_t(j) * m_Width]);
+		}
+	}
+
+	void Restore(Framebuffer& sums) const
+	{
+		for (int j = 0; j < m_Height; j++) {
+			std::copy(&m_Sums[size_t(j) * m_Width], &m_Sums[size_t(j) * m_Width] + m_Width, &sums(0, j));
+		}
+	}
+
+	// Fewest and most samples of any pixel.
+	void SampleRange(uint32_t& fewest, uint32_t& most) const
+	{
+		fewest = most = m_Samples.empty() ? 0 : m_Samples[0];
+
+		for (size_t k = 1; k < m_Samples.size(); k++) {
+			fewest = std::min(fewest, m_Samples[k]);
+			most = std::max(most, m_Samples[k]);
+		}
+	}
+
+	// Written next to "path" first and renamed over it, so an interruption
+	// leaves the previous checkpoint intact.
+	bool Write(const char* path) const
+	{
+		const std::string temporary = std::string(path) + ".tmp";
+
+		{
+			std::ofstream ofs(temporary.c_str(), std::ofstream::out | std::ofstream::binary);
+
+			ofs << "trt-checkpoint 1\n" << m_Settings << "\n" << m_Width << " " << m_Height << "\n";
+			ofs.write(reinterpret_cast<const char*>(m_Samples.data()), m_Samples.size() * sizeof(uint32_t));
+			ofs.write(reinterpret_cast<const char*>(m_Sums.data()), m_Sums.size() * sizeof(Vec3f));
+
+			if (!ofs.good()) return false;
+		}
+
+#if defined(_WIN32)
+		std::remove(path); // rename does not replace files on Windows.
+#endif
+
+		return std::rename(temporary.c_str(), path) == 0;
+	}
+
+	bool Read(const char* path)
+	{
+		std::ifstream ifs(path, std::ifstream::in | std::ifstream::binary);
+		std::string version;
+
+		if (!std::getline(ifs, version) || version != "trt-checkpoint 1" || !std::getline(ifs, m_Settings)) return false;
+		if (!(ifs >> m_Width >> m_Height) || ifs.get() != '\n' || m_Width <= 0 || m_Height <= 0) return false;
+
+		m_Samples.resize(size_t(m_Width) * m_Height);
+		m_Sums.resize(size_t(m_Width) * m_Height);
+
+		ifs.read(reinterpret_cast<char*>(m_Samples.data()), m_Samples.size() * sizeof(uint32_t));
+		ifs.read(reinterpret_cast<char*>(m_Sums.data()), m_Sums.size() * sizeof(Vec3f));
+
+		return ifs.good();
+	}
+};
+
+// Writes checkpoints on a background thread so rendering goes on meanwhile;
+// the render only pays for copying the buffers. One write is in flight at a
+// time: a new one first waits for the previous.
+//
+struct CheckpointWriter
+{
+	std::thread m_Thread;
+	Checkpoint m_Checkpoint;
+	bool m_Failed; // Some write failed; read it after Wait().
+
+	CheckpointWriter() : m_Failed(false) {}
+
+	~CheckpointWriter() { Wait(); }
+
+	void Write(const char* path, const std::string& settings, const Framebuffer& sums, const std::vector<uint32_t>& samples)
+	{
+		Wait();
+
+		m_Checkpoint.Capture(settings, sums, samples);
+		m_Thread = std::thread([this, path]() {
+			if (!m_Checkpoint.Write(path)) m_Failed = true;
+		});
+	}
+
+	void Wait()
+	{
+		if (m_Thread.joinable()) m_Thread.join();
+	}
+
+private:
+	CheckpointWriter(const CheckpointWriter&);
+	CheckpointWriter& operator=(const CheckpointWriter&);
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+
+#include "Geometry.h"
+#include "Parallel.h"
+#include "Framebuffer.h"
+#include "RenderStats.h"
+
+// What one pixel cost to render: rays of every kind, sphere and plane tests,
+// and time stamp counter cycles spent in CastRay.
+//
+struct PixelCost
+{
+	uint32_t m_Rays;
+	uint32_t m_Tests;
+	uint64_t m_Cycles;
+
+	PixelCost() : m_Rays(0), m_Tests(0), m_Cycles(0) {}
+};
+
+enum CostMetric
+{
+	CostRays,
+	CostTests,
+	CostCycles,
+};
+
+// Per-pixel diagnostic buffer, laid out like the framebuffer: rows padded to
+// TileAlignment pixels, so tiles never share a cache line here either.
+//
+struct CostMap
+{
+	int m_Width;
+	int m_Height;
+	int m_Stride;
+
+	AlignedVector<PixelCost> m_Pixels;
+
+	CostMap(int width, int height)
+		: m_Width(width), m_Height(height), m_Stride((width + TileAlignment - 1) / TileAlignment * TileAlignment),
+		  m_Pixels(size_t(m_Stride) * height) {}
+
+	      PixelCost& operator()(int i, int j)       { return m_Pixels[i + size_t(j) * m_Stride]; }
+	const PixelCost& operator()(int i, int j) const { return m_Pixels[i + size_t(j) * m_Stride]; }
+
+	// Adds the counters accumulated between "before" and "after" to pixel (i, j).
+	void Record(int i, int j, const RenderStats& before, const RenderStats& after, uint64_t cycles, int share = 1)
+	{
+		PixelCost& cost = (*this)(i, j);
+
+		cost.m_Rays += uint32_t((after.TotalRays() - before.TotalRays()) / share);
+		cost.m_Tests += uint32_t((after.m_IntersectionTests - before.m_IntersectionTests) / share);
+		cost.m_Cycles += cycles / share;
+	}
+
+	double Value(int i, int j, CostMetric metric) const
+	{
+		const PixelCost& cost = (*this)(i, j);
+
+		return metric == CostRays ? cost.m_Rays : metric == CostTests ? cost.m_Tests : (double)cost.m_Cycles;
+	}
+
+	// Value below which the given fraction of the pixels lie.
+	double Percentile(CostMetric metric, double fraction) const
+	{
+		std::vector<double> values;
+		values.reserve(size_t(m_Width) * m_Height);
+
+		for (int j = 0; j < m_Height; j++) {
+			for (int i = 0; i < m_Width; i++) values.push_back(Value(i, j, metric));
+		}
+
+		if (values.empty()) return 0.0;
+
+		size_t k = std::min(values.size() - 1, size_t(fraction * (values.size() - 1) + 0.5));
+		std::nth_element(values.begin(), values.begin() + k, values.end());
+
+		return values[k];
+	}
+};
+
+// Black, blue, magenta, red, yellow, white for t in [0, 1].
+inline Vec3f HeatColor(float t)
+{
+	const Vec3f ramp[] = { Vec3f(0.0f, 0.0f, 0.0f), Vec3f(0.1f, 0.1f, 0.8f), Vec3f(0.8f, 0.1f, 0.8f),
+	                       Vec3f(1.0f, 0.1f, 0.1f), Vec3f(1.0f, 0.9f, 0.1f), Vec3f(1.0f, 1.0f, 1.0f) };
+	const int last = sizeof(ramp) / sizeof(ramp[0]) - 1;
+
+	float x = std::min(std::max(t, 0.0f), 1.0f) * last;
+	int k = std::min((int)x, last - 1);
+
+	return ramp[k] * (1.0f - (x - k)) + ramp[k + 1] * (x - k);
+}
+
+// False colors on a log scale between "low" and "high", so both the
+// background and the deepest recursion stay readable. Pixels beyond the range
+// are clamped.
+//
+inline Framebuffer HeatmapImage(const CostMap& costs, CostMetric metric, double low, double high)
+{
+	Framebuffer image(costs.m_Width, costs.m_Height);
+
+	double offset = std::log1p(low);
+	double scale = 1.0 / std::max(1e-6, std::log1p(high) - offset);
+
+	for (int j = 0; j < costs.m_Height; j++) {
+		for (int i = 0; i < costs.m_Width; i++) image(i, j) = HeatColor(float((std::log1p(costs.Value(i, j, metric)) - offset) * scale));
+	}
+
+	return image;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// CPU package energy from the Linux powercap interface to RAPL (running
+// average power limit) counters, in /sys/class/powercap/intel-rapl:N, which
+// AMD processors expose too. The counters are microjoule totals that wrap
+// at max_energy_range_uj. Off Linux, in most virtual machines, and where the
+// files are readable by root only, no domain is found and Available() is
+// false.
+//
+struct EnergyDomain
+{
+	std::string m_Path; // Directory of the zone.
+	std::string m_Name;
+	uint64_t m_Range;   // The counter wraps here.
+	uint64_t m_Start;
+};
+
+struct EnergyMeter
+{
+	std::vector<EnergyDomain> m_Domains;
+
+	explicit EnergyMeter(const std::string& root = "/sys/class/powercap")
+	{
+#if defined(__linux__)
+		// Top level zones are numbered from 0; their subzones (core, uncore,
+		// dram) are already part of the package total. The platform zone
+		// ("psys") covers the packages too, so it is only kept alone.
+		std::vector<EnergyDomain> platform;
+
+		for (int k = 0; k < 64; k++) {
+			std::ostringstream path;
+			path << root << "/intel-rapl:" << k;
+
+			EnergyDomain domain;
+			domain.m_Path = path.str();
+
+			if (!ReadLine(domain.m_Path + "/name", domain.m_Name)) break;
+			if (!ReadValue(domain.m_Path + "/max_energy_range_uj", domain.m_Range) || !ReadValue(domain.m_Path + "/energy_uj", domain.m_Start)) continue;
+
+			if (domain.m_Name == "psys") platform.push_back(domain);
+			else m_Domains.push_back(domain);
+		}
+
+		if (m_Domains.empty()) m_Domains = platform;
+#else
+		(void)root;
+#endif
+	}
+
+	bool Available() const { return !m_Domains.empty(); }
+
+	void Start()
+	{
+		for (size_t i = 0; i < m_Domains.size(); i++) ReadValue(m_Domains[i].m_Path + "/energy_uj", m_Domains[i].m_Start);
+	}
+
+	// Joules used by all domains since Start().
+	double Joules() const
+	{
+		double total = 0.0;
+
+		for (size_t i = 0; i < m_Domains.size(); i++) {
+			const EnergyDomain& domain = m_Domains[i];
+			uint64_t now;
+
+			if (!ReadValue(domain.m_Path + "/energy_uj", now)) continue;
+
+			uint64_t used = now >= domain.m_Start ? now - domain.m_Start : now + domain.m_Range - domain.m_Start;
+			total += used * 1e-6;
+		}
+
+		return total;
+	}
+
+	static bool ReadLine(const std::string& path, std::string& line)
+	{
+		std::ifstream ifs(path.c_str());
+
+		return (bool)std::getline(ifs, line);
+	}
+
+	static bool ReadValue(const std::string& path, uint64_t& value)
+	{
+		std::ifstream ifs(path.c_str());
+
+		return (bool)(ifs >> value);
+	}
+};
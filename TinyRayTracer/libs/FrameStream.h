@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#include "Geometry.h"
+#include "Framebuffer.h"
+
+enum StreamFormat
+{
+	StreamPpm, // One binary PPM after the other, as ffmpeg's image2pipe reads them.
+	StreamY4m, // YUV4MPEG2, 4:2:0, what most encoders take on stdin.
+};
+
+// BT.601 Y'CbCr in studio range of "count" pixels given as planar R, G and B,
+// clamped to [0, 1]. Any of the outputs may be NULL: luma is computed at full
+// resolution and chroma from 2x2 averages, in separate calls.
+//
+inline void RgbToYuv(const float* r, const float* g, const float* b, int count, uint8_t* y, uint8_t* u, uint8_t* v)
+{
+	const float kr = 0.299f, kg = 0.587f, kb = 0.114f;
+	const float cu = 224.0f / 255.0f / (2.0f * (1.0f - kb)), cv = 224.0f / 255.0f / (2.0f * (1.0f - kr));
+
+	int i = 0;
+
+#if defined(__AVX__)
+	const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+
+	for (; i + 8 <= count; i += 8) {
+		__m256 rr = _mm256_min_ps(one, _mm256_max_ps(zero, _mm256_loadu_ps(r + i)));
+		__m256 gg = _mm256_min_ps(one, _mm256_max_ps(zero, _mm256_loadu_ps(g + i)));
+		__m256 bb = _mm256_min_ps(one, _mm256_max_ps(zero, _mm256_loadu_ps(b + i)));
+		__m256 luma = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rr, _mm256_set1_ps(kr)), _mm256_mul_ps(gg, _mm256_set1_ps(kg))), _mm256_mul_ps(bb, _mm256_set1_ps(kb)));
+
+		// Offset, scale and round half up, then narrow 8 x int32 to 8 bytes.
+		__m256 planes[3] = {
+			_mm256_add_ps(_mm256_set1_ps(16.5f), _mm256_mul_ps(luma, _mm256_set1_ps(219.0f))),
+			_mm256_add_ps(_mm256_set1_ps(128.5f), _mm256_mul_ps(_mm256_sub_ps(bb, luma), _mm256_set1_ps(cu * 255.0f))),
+			_mm256_add_ps(_mm256_set1_ps(128.5f), _mm256_mul_ps(_mm256_sub_ps(rr, luma), _mm256_set1_ps(cv * 255.0f))),
+		};
+		uint8_t* outputs[3] = { y, u, v };
+
+		for (int p = 0; p < 3; p++) {
+			if (!outputs[p]) continue;
+
+			__m256i words = _mm256_cvttps_epi32(planes[p]);
+			__m128i shorts = _mm_packs_epi32(_mm256_castsi256_si128(words), _mm256_extractf128_si256(words, 1));
+
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(outputs[p] + i), _mm_packus_epi16(shorts, shorts));
+		}
+	}
+#endif
+
+	for (; i < count; i++) {
+		float rr = std::min(1.0f, std::max(0.0f, r[i]));
+		float gg = std::min(1.0f, std::max(0.0f, g[i]));
+		float bb = std::min(1.0f, std::max(0.0f, b[i]));
+		float luma = rr * kr + gg * kg + bb * kb;
+
+		if (y) y[i] = (uint8_t)(int)(16.5f + luma * 219.0f);
+		if (u) u[i] = (uint8_t)(int)(128.5f + (bb - luma) * (cu * 255.0f));
+		if (v) v[i] = (uint8_t)(int)(128.5f + (rr - luma) * (cv * 255.0f));
+	}
+}
+
+// Frames written one after the other to stdout ("-"), a file or a named pipe,
+// flushed as each one is complete so an encoder reading the other end never
+// waits for the next frame to start.
+//
+struct FrameStream
+{
+	FILE* m_File;
+	bool m_Owned;          // Opened here, so closed here; stdout is not.
+	StreamFormat m_Format;
+	int m_FrameRate;
+	bool m_Started;        // The Y4M stream header is out.
+
+	std::vector<uint8_t> m_Bytes;
+	std::vector<float> m_Planes; // Rows of planar R, G, B, full and half resolution.
+
+	FrameStream() : m_File(NULL), m_Owned(false), m_Format(StreamPpm), m_FrameRate(30), m_Started(false) {}
+
+	~FrameStream()
+	{
+		if (m_Owned && m_File) fclose(m_File);
+	}
+
+	bool Open(const char* path, StreamFormat format, int frameRate)
+	{
+		m_Format = format;
+		m_FrameRate = frameRate;
+
+		if (!strcmp(path, "-"))
+		{
+#if defined(_WIN32)
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			m_File = stdout;
+			m_Owned = false;
+		}
+		else
+		{
+			m_File = fopen(path, "wb");
+			m_Owned = true;
+		}
+
+		return m_File != NULL;
+	}
+
+	bool WriteFrame(const Framebuffer& framebuffer)
+	{
+		if (m_Format == StreamY4m) EncodeY4m(framebuffer);
+		else EncodePpm(framebuffer);
+
+		return fwrite(m_Bytes.data(), 1, m_Bytes.size(), m_File) == m_Bytes.size() && fflush(m_File) == 0;
+	}
+
+	// The same bytes WriteImage puts in a file.
+	void EncodePpm(const Framebuffer& framebuffer)
+	{
+		const std::string header = "P6\n" + std::to_string(framebuffer.m_Width) + " " + std::to_string(framebuffer.m_Height) + "\n255\n";
+
+		m_Bytes.assign(header.begin(), header.end());
+		m_Bytes.reserve(m_Bytes.size() + size_t(framebuffer.m_Width) * framebuffer.m_Height * 3);
+
+		for (int j = 0; j < framebuffer.m_Height; j++) {
+			for (int i = 0; i < framebuffer.m_Width; i++) {
+				for (size_t k = 0; k < 3; k++) {
+					m_Bytes.push_back((uint8_t)(255 * std::max(0.0f, std::min(1.0f, framebuffer(i, j)[k]))));
+				}
+			}
+		}
+	}
+
+	// Planar Y, then U and V at half the width and height, sited between
+	// their four pixels ("420jpeg"); odd sizes repeat the last row and column.
+	//
+	void EncodeY4m(const Framebuffer& framebuffer)
+	{
+		const int width = framebuffer.m_Width, height = framebuffer.m_Height;
+		const int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+
+		m_Bytes.clear();
+
+		if (!m_Started)
+		{
+			const std::string header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) + " F" + std::to_string(m_FrameRate)
+			                         + ":1 Ip A1:1 C420jpeg XYSCSS=420JPEG XCOLORRANGE=LIMITED\n";
+
+			m_Bytes.assign(header.begin(), header.end());
+			m_Started = true;
+		}
+
+		const char frame[] = "FRAME\n";
+		const size_t start = m_Bytes.size() + sizeof(frame) - 1;
+
+		m_Bytes.insert(m_Bytes.end(), frame, frame + sizeof(frame) - 1);
+		m_Bytes.resize(start + size_t(width) * height + 2 * size_t(chromaWidth) * chromaHeight);
+
+		uint8_t* lumaPlane = &m_Bytes[start];
+		uint8_t* uPlane = lumaPlane + size_t(width) * height;
+		uint8_t* vPlane = uPlane + size_t(chromaWidth) * chromaHeight;
+
+		m_Planes.resize(3 * size_t(width) + 3 * size_t(chromaWidth));
+
+		float* rgb[3] = { &m_Planes[0], &m_Planes[width], &m_Planes[2 * size_t(width)] };
+		float* average[3] = { &m_Planes[3 * size_t(width)], &m_Planes[3 * size_t(width) + chromaWidth], &m_Planes[3 * size_t(width) + 2 * chromaWidth] };
+
+		for (int j = 0; j < height; j += 2) {
+			const int below = std::min(j + 1, height - 1);
+
+			for (int k = 0; k < 3; k++) std::fill(average[k], average[k] + chromaWidth, 0.0f);
+
+			for (int row = j; row <= below; row++) {
+				for (int i = 0; i < width; i++) {
+					const Vec3f& color = framebuffer(i, row);
+
+					for (int k = 0; k < 3; k++) {
+						rgb[k][i] = color[k];
+						average[k][i / 2] += std::min(1.0f, std::max(0.0f, color[k]));
+					}
+				}
+
+				RgbToYuv(rgb[0], rgb[1], rgb[2], width, lumaPlane + size_t(row) * width, NULL, NULL);
+			}
+
+			// Chroma of the 2x2 block; missing pixels of odd sizes count as their neighbours.
+			const float rows = below > j ? 1.0f : 2.0f;
+
+			for (int c = 0; c < chromaWidth; c++) {
+				const float scale = 0.25f * rows * (2 * c + 1 < width ? 1.0f : 2.0f);
+
+				for (int k = 0; k < 3; k++) average[k][c] *= scale;
+			}
+
+			RgbToYuv(average[0], average[1], average[2], chromaWidth, NULL, uPlane + size_t(j / 2) * chromaWidth, vPlane + size_t(j / 2) * chromaWidth);
+		}
+	}
+
+private:
+	FrameStream(const FrameStream&);
+	FrameStream& operator=(const FrameStream&);
+};
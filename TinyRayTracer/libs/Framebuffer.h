@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "Geometry.h"
+#include "Parallel.h"
+
+// Number of pixels whose storage is a whole number of cache lines (16 * 12 bytes = 3 lines).
+// Tiles are this wide (or a multiple of it), and rows are padded to it, so that
+// a tile never shares a cache line with a neighbouring tile.
+//
+const int TileAlignment = 16;
+const int TileSize = 2 * TileAlignment;
+
+static_assert((TileAlignment * sizeof(Vec3f)) % CacheLineSize == 0, "TileAlignment pixels must fill whole cache lines.");
+static_assert(TileSize % TileAlignment == 0, "TileSize must be a multiple of TileAlignment.");
+
+struct Tile
+{
+	int m_X0, m_Y0, m_X1, m_Y1; // Half-open pixel range [x0, x1) x [y0, y1).
+
+	Tile(int x0, int y0, int x1, int y1)
+		: m_X0(x0), m_Y0(y0), m_X1(x1), m_Y1(y1) {}
+};
+
+struct Framebuffer
+{
+	int m_Width;
+	int m_Height;
+	int m_Stride; // Pixels per row, rounded up so every row starts on a cache line.
+
+	AlignedVector<Vec3f> m_Pixels; // Storage, unless the pixels live elsewhere.
+	Vec3f* m_Data;                 // First pixel, in m_Pixels or the memory given.
+
+	Framebuffer(int width, int height)
+		: m_Width(width), m_Height(height), m_Stride(PaddedWidth(width)),
+		  m_Pixels(size_t(m_Stride) * height), m_Data(m_Pixels.data()) {}
+
+	// Pixels in memory owned by someone else, such as a shared memory
+	// segment, with the same padded layout: PixelCount(width, height) pixels
+	// aligned to a cache line. Copies of the framebuffer own their pixels.
+	//
+	Framebuffer(int width, int height, Vec3f* pixels)
+		: m_Width(width), m_Height(height), m_Stride(PaddedWidth(width)), m_Pixels(), m_Data(pixels) {}
+
+	Framebuffer(const Framebuffer& other)
+		: m_Width(other.m_Width), m_Height(other.m_Height), m_Stride(other.m_Stride),
+		  m_Pixels(other.m_Data, other.m_Data + size_t(other.m_Stride) * other.m_Height), m_Data(m_Pixels.data()) {}
+
+	Framebuffer& operator=(const Framebuffer& other)
+	{
+		if (this != &other)
+		{
+			m_Width = other.m_Width;
+			m_Height = other.m_Height;
+			m_Stride = other.m_Stride;
+			m_Pixels.assign(other.m_Data, other.m_Data + size_t(other.m_Stride) * other.m_Height);
+			m_Data = m_Pixels.data();
+		}
+
+		return *this;
+	}
+
+	static int PaddedWidth(int width) { return (width + TileAlignment - 1) / TileAlignment * TileAlignment; }
+	static size_t PixelCount(int width, int height) { return size_t(PaddedWidth(width)) * height; }
+
+	      Vec3f& operator()(int i, int j)       { return m_Data[i + size_t(j) * m_Stride]; }
+	const Vec3f& operator()(int i, int j) const { return m_Data[i + size_t(j) * m_Stride]; }
+
+	std::vector<Tile> Tiles(int tileSize = TileSize) const
+	{
+		return Tiles(Tile(0, 0, m_Width, m_Height), tileSize);
+	}
+
+	// Tiles of the usual grid that overlap "bounds". They are not clipped, so
+	// their edges stay on cache line boundaries; pixels outside the region
+	// are skipped while rendering.
+	//
+	std::vector<Tile> Tiles(const Tile& bounds, int tileSize = TileSize) const
+	{
+		std::vector<Tile> tiles;
+
+		for (int y = 0; y < m_Height; y += tileSize) {
+			for (int x = 0; x < m_Width; x += tileSize) {
+				if (x + tileSize <= bounds.m_X0 || x >= bounds.m_X1 || y + tileSize <= bounds.m_Y0 || y >= bounds.m_Y1) continue;
+
+				tiles.push_back(Tile(x, y, std::min(x + tileSize, m_Width), std::min(y + tileSize, m_Height)));
+			}
+		}
+
+		return tiles;
+	}
+};
+
+// Pixels to render when only part of the frame is traced: a rectangle,
+// optionally a mask of the same size as the frame (non-zero: render), and
+// optionally one half of a checkerboard.
+//
+struct RenderRegion
+{
+	Tile m_Bounds;
+	int m_MaskWidth;
+	std::vector<uint8_t> m_Mask;
+	int m_Checkerboard; // -1, or a frame number: pixels with (i + j + frame) even are rendered.
+
+	explicit RenderRegion(const Tile& bounds)
+		: m_Bounds(bounds), m_MaskWidth(0), m_Checkerboard(-1) {}
+
+	bool Contains(int i, int j) const
+	{
+		if (i < m_Bounds.m_X0 || i >= m_Bounds.m_X1 || j < m_Bounds.m_Y0 || j >= m_Bounds.m_Y1) return false;
+		if (m_Checkerboard >= 0 && ((i + j + m_Checkerboard) & 1)) return false;
+
+		return m_Mask.empty() || m_Mask[i + size_t(j) * m_MaskWidth] != 0;
+	}
+
+	size_t PixelCount() const
+	{
+		size_t count = 0;
+
+		for (int j = m_Bounds.m_Y0; j < m_Bounds.m_Y1; j++) {
+			for (int i = m_Bounds.m_X0; i < m_Bounds.m_X1; i++) count += Contains(i, j);
+		}
+
+		return count;
+	}
+};
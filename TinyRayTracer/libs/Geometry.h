@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cassert>
+#include <cmath>
 #include <iostream>
 
 template <size_t DIM, typename T> struct vec
@@ -17,6 +18,7 @@ private:
 typedef vec<2, float> Vec2f;
 typedef vec<2, int  > Vec2i;
 typedef vec<3, float> Vec3f;
+typedef vec<3, double> Vec3d;
 typedef vec<3, int  > Vec3i;
 typedef vec<4, float> Vec4f;
 typedef vec<4, int  > Vec4i;
@@ -24,8 +26,8 @@ typedef vec<4, int  > Vec4i;
 // Specializations. {{{
 template <typename T> struct vec<2, T>
 {
-    vec() : x(T()), y(T()) {}
-    vec(T X, T Y) : x(X), y(Y) {}
+    constexpr vec() : x(T()), y(T()) {}
+    constexpr vec(T X, T Y) : x(X), y(Y) {}
 
           T& operator[](const size_t i)       { assert(i >= 0 && i < 2); return i == 0 ? x : y; }
     const T& operator[](const size_t i) const { assert(i >= 0 && i < 2); return i == 0 ? x : y; }
@@ -35,14 +37,17 @@ template <typename T> struct vec<2, T>
 
 template <typename T> struct vec<3, T>
 {
-    vec() : x(T()), y(T()), z(T()) {}
-    vec(T X, T Y, T Z) : x(X), y(Y), z(Z) {}
+    constexpr vec() : x(T()), y(T()), z(T()) {}
+    constexpr vec(T X, T Y, T Z) : x(X), y(Y), z(Z) {}
+
+    // Precision conversion, e.g. between Vec3f and Vec3d.
+    template <typename U> constexpr explicit vec(const vec<3, U>& v) : x(T(v.x)), y(T(v.y)), z(T(v.z)) {}
 
           T& operator[](const size_t i)       { assert(i >= 0 && i < 3); return i == 0 ? x : (i == 1 ? y : z); }
     const T& operator[](const size_t i) const { assert(i >= 0 && i < 3); return i == 0 ? x : (i == 1 ? y : z); }
     
-    float norm()       { return std::sqrt(x * x + y * y + z * z); }
-    float norm() const { return std::sqrt(x * x + y * y + z * z); }
+    T norm()       { return std::sqrt(x * x + y * y + z * z); }
+    T norm() const { return std::sqrt(x * x + y * y + z * z); }
 
     vec<3, T>& normalize(T l = 1) { *this = (*this) * (l / norm()); return *this; }
 
@@ -54,8 +59,8 @@ template <typename T> struct vec<3, T>
 };
 
 template <typename T> struct vec<4, T> {
-    vec() : x(T()), y(T()), z(T()), w(T()) {}
-    vec(T X, T Y, T Z, T W) : x(X), y(Y), z(Z), w(W) {}
+    constexpr vec() : x(T()), y(T()), z(T()), w(T()) {}
+    constexpr vec(T X, T Y, T Z, T W) : x(X), y(Y), z(Z), w(W) {}
 
           T& operator[](const size_t i)       { assert(i >= 0 && i < 4); return i == 0 ? x : (i == 1 ? y : (i == 2 ? z : w)); }
     const T& operator[](const size_t i) const { assert(i >= 0 && i < 4); return i == 0 ? x : (i == 1 ? y : (i == 2 ? z : w)); }
@@ -101,6 +106,39 @@ template<size_t DIM, typename T> vec<DIM, T> operator-(const vec<DIM, T>& lhs) {
     return lhs * T(-1);
 }
 
+// Fused operators for the specializations. {{{
+//
+// The loops above go through operator[], which for the specializations is a
+// chain of conditionals on the index, and build the result in a zeroed
+// temporary. These overloads are more specialized, so they are picked for
+// 2, 3 and 4 components: each one is a single constructor call, and an
+// expression like "a + b * s - c" inlines into one pass over x, y, z with
+// no intermediate vec left in memory. They return the same types as the
+// generic versions, so existing code keeps compiling unchanged.
+//
+// Dot products sum from the last component, as the generic loop does, so results are bit-identical.
+template<typename T> constexpr T operator*(const vec<2, T>& lhs, const vec<2, T>& rhs) { return lhs.y * rhs.y + lhs.x * rhs.x; }
+template<typename T> constexpr T operator*(const vec<3, T>& lhs, const vec<3, T>& rhs) { return lhs.z * rhs.z + lhs.y * rhs.y + lhs.x * rhs.x; }
+template<typename T> constexpr T operator*(const vec<4, T>& lhs, const vec<4, T>& rhs) { return lhs.w * rhs.w + lhs.z * rhs.z + lhs.y * rhs.y + lhs.x * rhs.x; }
+
+template<typename T> constexpr vec<2, T> operator+(const vec<2, T>& lhs, const vec<2, T>& rhs) { return vec<2, T>(lhs.x + rhs.x, lhs.y + rhs.y); }
+template<typename T> constexpr vec<3, T> operator+(const vec<3, T>& lhs, const vec<3, T>& rhs) { return vec<3, T>(lhs.x + rhs.x, lhs.y + rhs.y, lhs.z + rhs.z); }
+template<typename T> constexpr vec<4, T> operator+(const vec<4, T>& lhs, const vec<4, T>& rhs) { return vec<4, T>(lhs.x + rhs.x, lhs.y + rhs.y, lhs.z + rhs.z, lhs.w + rhs.w); }
+
+template<typename T> constexpr vec<2, T> operator-(const vec<2, T>& lhs, const vec<2, T>& rhs) { return vec<2, T>(lhs.x - rhs.x, lhs.y - rhs.y); }
+template<typename T> constexpr vec<3, T> operator-(const vec<3, T>& lhs, const vec<3, T>& rhs) { return vec<3, T>(lhs.x - rhs.x, lhs.y - rhs.y, lhs.z - rhs.z); }
+template<typename T> constexpr vec<4, T> operator-(const vec<4, T>& lhs, const vec<4, T>& rhs) { return vec<4, T>(lhs.x - rhs.x, lhs.y - rhs.y, lhs.z - rhs.z, lhs.w - rhs.w); }
+
+// Like the generic version, the product is taken in the type of "rhs" and then converted.
+template<typename T, typename U> constexpr vec<2, T> operator*(const vec<2, T>& lhs, const U& rhs) { return vec<2, T>(T(lhs.x * rhs), T(lhs.y * rhs)); }
+template<typename T, typename U> constexpr vec<3, T> operator*(const vec<3, T>& lhs, const U& rhs) { return vec<3, T>(T(lhs.x * rhs), T(lhs.y * rhs), T(lhs.z * rhs)); }
+template<typename T, typename U> constexpr vec<4, T> operator*(const vec<4, T>& lhs, const U& rhs) { return vec<4, T>(T(lhs.x * rhs), T(lhs.y * rhs), T(lhs.z * rhs), T(lhs.w * rhs)); }
+
+template<typename T> constexpr vec<2, T> operator-(const vec<2, T>& lhs) { return vec<2, T>(-lhs.x, -lhs.y); }
+template<typename T> constexpr vec<3, T> operator-(const vec<3, T>& lhs) { return vec<3, T>(-lhs.x, -lhs.y, -lhs.z); }
+template<typename T> constexpr vec<4, T> operator-(const vec<4, T>& lhs) { return vec<4, T>(-lhs.x, -lhs.y, -lhs.z, -lhs.w); }
+// }}}
+
 template <size_t DIM, typename T> std::ostream& operator<<(std::ostream& out, const vec<DIM, T>& v) {
     for (unsigned int i = 0; i < DIM; i++) {
         out << v[i] << " ";
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "Geometry.h"
+#include "Framebuffer.h"
+
+// Binary PGM (P5) and PPM (P6) images with 8-bit samples.
+struct PnmImage
+{
+	int m_Width;
+	int m_Height;
+	int m_Channels; // 1 for PGM, 3 for PPM.
+	std::vector<uint8_t> m_Bytes;
+
+	PnmImage() : m_Width(0), m_Height(0), m_Channels(0) {}
+
+	uint8_t At(int i, int j, int channel) const { return m_Bytes[(i + size_t(j) * m_Width) * m_Channels + channel]; }
+};
+
+// Next header field, skipping white space and comments.
+inline bool ReadPnmField(std::istream& is, std::string& field)
+{
+	field.clear();
+
+	for (int c = is.get(); c != EOF; c = is.get()) {
+		if (c == '#')
+		{
+			while (c != EOF && c != '\n') c = is.get();
+		}
+		else if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+		{
+			if (!field.empty()) return true;
+		}
+		else field += (char)c;
+	}
+
+	return !field.empty();
+}
+
+inline bool ReadPnm(const char* path, PnmImage& image)
+{
+	std::ifstream ifs(path, std::ifstream::in | std::ifstream::binary);
+	std::string magic, width, height, maxValue;
+
+	if (!ReadPnmField(ifs, magic) || !ReadPnmField(ifs, width) || !ReadPnmField(ifs, height) || !ReadPnmField(ifs, maxValue)) return false;
+	if ((magic != "P5" && magic != "P6") || maxValue != "255") return false;
+
+	image.m_Width = atoi(width.c_str());
+	image.m_Height = atoi(height.c_str());
+	image.m_Channels = magic == "P5" ? 1 : 3;
+
+	if (image.m_Width <= 0 || image.m_Height <= 0) return false;
+
+	image.m_Bytes.resize(size_t(image.m_Width) * image.m_Height * image.m_Channels);
+	ifs.read(reinterpret_cast<char*>(&image.m_Bytes[0]), image.m_Bytes.size());
+
+	return ifs.gcount() == (std::streamsize)image.m_Bytes.size();
+}
+
+// Loads an image written by WriteImage into a framebuffer of the same size.
+// Values sit in the middle of their 8-bit step, so writing the framebuffer
+// again gives back the same bytes.
+//
+inline bool LoadFramebuffer(const char* path, Framebuffer& framebuffer)
+{
+	PnmImage image;
+
+	if (!ReadPnm(path, image) || image.m_Channels != 3 || image.m_Width != framebuffer.m_Width || image.m_Height != framebuffer.m_Height) return false;
+
+	for (int j = 0; j < image.m_Height; j++) {
+		for (int i = 0; i < image.m_Width; i++) {
+			for (int k = 0; k < 3; k++) framebuffer(i, j)[k] = (image.At(i, j, k) + 0.5f) / 255.0f;
+		}
+	}
+
+	return true;
+}
+
+// A PGM or PPM mask of the frame size; pixels whose first channel is not
+// zero are rendered. The region bounds shrink to the mask's bounding box.
+//
+inline bool LoadMask(const char* path, int width, int height, RenderRegion& region)
+{
+	PnmImage image;
+
+	if (!ReadPnm(path, image) || image.m_Width != width || image.m_Height != height) return false;
+
+	region.m_MaskWidth = width;
+	region.m_Mask.assign(size_t(width) * height, 0);
+
+	Tile bounds(width, height, 0, 0);
+
+	for (int j = 0; j < height; j++) {
+		for (int i = 0; i < width; i++) {
+			if (!image.At(i, j, 0)) continue;
+
+			region.m_Mask[i + size_t(j) * width] = 1;
+
+			bounds.m_X0 = std::min(bounds.m_X0, i);
+			bounds.m_Y0 = std::min(bounds.m_Y0, j);
+			bounds.m_X1 = std::max(bounds.m_X1, i + 1);
+			bounds.m_Y1 = std::max(bounds.m_Y1, j + 1);
+		}
+	}
+
+	region.m_Bounds.m_X0 = std::max(region.m_Bounds.m_X0, bounds.m_X0);
+	region.m_Bounds.m_Y0 = std::max(region.m_Bounds.m_Y0, bounds.m_Y0);
+	region.m_Bounds.m_X1 = std::min(region.m_Bounds.m_X1, bounds.m_X1);
+	region.m_Bounds.m_Y1 = std::min(region.m_Bounds.m_Y1, bounds.m_Y1);
+
+	return true;
+}
+
+inline bool WritePnm(const char* path, const PnmImage& image)
+{
+	std::ofstream ofs(path, std::ofstream::out | std::ofstream::binary);
+
+	ofs << (image.m_Channels == 1 ? "P5" : "P6") << "\n" << image.m_Width << " " << image.m_Height << "\n255\n";
+	ofs.write(reinterpret_cast<const char*>(image.m_Bytes.data()), image.m_Bytes.size());
+
+	return ofs.good();
+}
+
+// How far apart two images are, over all channels, in 8-bit steps.
+struct ImageDifference
+{
+	double m_Rmse;
+	double m_Psnr;      // In dB; infinite for identical images.
+	int m_MaxError;
+	double m_Differing; // Share of pixels with a channel off by more than the threshold.
+
+	ImageDifference() : m_Rmse(0.0), m_Psnr(0.0), m_MaxError(0), m_Differing(0.0) {}
+};
+
+// Fails unless both images have the same size and channels. "map", when
+// given, receives a PGM of every pixel's largest channel error, times 8.
+//
+inline bool CompareImages(const PnmImage& a, const PnmImage& b, int threshold, ImageDifference& difference, PnmImage* map = NULL)
+{
+	if (a.m_Width != b.m_Width || a.m_Height != b.m_Height || a.m_Channels != b.m_Channels) return false;
+
+	double squares = 0.0;
+	size_t differing = 0;
+
+	if (map)
+	{
+		map->m_Width = a.m_Width;
+		map->m_Height = a.m_Height;
+		map->m_Channels = 1;
+		map->m_Bytes.assign(size_t(a.m_Width) * a.m_Height, 0);
+	}
+
+	difference = ImageDifference();
+
+	for (int j = 0; j < a.m_Height; j++) {
+		for (int i = 0; i < a.m_Width; i++) {
+			int largest = 0;
+
+			for (int k = 0; k < a.m_Channels; k++) {
+				int error = std::abs(int(a.At(i, j, k)) - int(b.At(i, j, k)));
+
+				squares += double(error) * error;
+				largest = std::max(largest, error);
+			}
+
+			difference.m_MaxError = std::max(difference.m_MaxError, largest);
+			differing += largest > threshold;
+
+			if (map) map->m_Bytes[i + size_t(j) * a.m_Width] = (uint8_t)std::min(255, largest * 8);
+		}
+	}
+
+	const double pixels = double(a.m_Width) * a.m_Height;
+
+	difference.m_Rmse = std::sqrt(squares / (pixels * a.m_Channels));
+	difference.m_Psnr = difference.m_Rmse > 0.0 ? 20.0 * std::log10(255.0 / difference.m_Rmse) : std::numeric_limits<double>::infinity();
+	difference.m_Differing = differing / pixels;
+
+	return true;
+}
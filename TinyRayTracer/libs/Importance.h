@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include "Image.h"
+
+// Effort spent on one pixel.
+struct ShadingRate
+{
+	int m_Samples;         // Samples per pixel.
+	int m_LightSamples;    // Samples per area light and strategy.
+	int m_Depth;           // Ray depth, plus one for a share m_DepthFraction of the samples.
+	float m_DepthFraction;
+};
+
+// Per-pixel importance in [floor, 1], from a grayscale image or a radial
+// falloff around a focus point, that scales the full settings of a render
+// down to the pixel's ShadingRate. Every rate is rounded up, and the ray
+// depth is dithered between its two neighbours per sample. The map itself
+// is smooth, so the rates change gradually over the frame and the noise
+// level changes with them, without edges where a setting steps down.
+//
+struct ImportanceMap
+{
+	int m_Width;
+	int m_Height;
+	std::vector<float> m_Values;
+
+	int m_Samples;      // Settings at importance 1,
+	int m_LightSamples;
+	int m_MaxDepth;
+	int m_MinDepth;     // and the depth at importance 0.
+
+	ImportanceMap(int width, int height, int samples, int lightSamples, int maxDepth, int minDepth)
+		: m_Width(width), m_Height(height), m_Values(size_t(width) * height, 1.0f),
+		  m_Samples(samples), m_LightSamples(lightSamples), m_MaxDepth(maxDepth), m_MinDepth(std::min(minDepth, maxDepth)) {}
+
+	// Full importance within "radius" pixels of (x, y), easing down to
+	// "floor" at twice the radius.
+	void Radial(float x, float y, float radius, float floor)
+	{
+		radius = std::max(radius, 1.0f);
+
+		for (int j = 0; j < m_Height; j++) {
+			for (int i = 0; i < m_Width; i++) {
+				float r = std::sqrt((i + 0.5f - x) * (i + 0.5f - x) + (j + 0.5f - y) * (j + 0.5f - y));
+				float s = std::min(1.0f, std::max(0.0f, r / radius - 1.0f));
+
+				m_Values[i + size_t(j) * m_Width] = floor + (1.0f - floor) * (1.0f - s * s * (3.0f - 2.0f * s));
+			}
+		}
+	}
+
+	// A PGM or PPM of the frame size, white for full importance. Painted
+	// maps have hard edges, so they are blurred over "smoothing" pixels.
+	bool Load(const char* path, float floor, int smoothing)
+	{
+		PnmImage image;
+
+		if (!ReadPnm(path, image) || image.m_Width != m_Width || image.m_Height != m_Height) return false;
+
+		for (int j = 0; j < m_Height; j++) {
+			for (int i = 0; i < m_Width; i++) m_Values[i + size_t(j) * m_Width] = image.At(i, j, 0) / 255.0f;
+		}
+
+		// Two box passes each way: a tent filter.
+		for (int pass = 0; pass < 2; pass++) {
+			Blur(smoothing / 2, true);
+			Blur(smoothing / 2, false);
+		}
+
+		for (size_t k = 0; k < m_Values.size(); k++) m_Values[k] = floor + (1.0f - floor) * m_Values[k];
+
+		return true;
+	}
+
+	ShadingRate Rate(int i, int j) const
+	{
+		const float importance = m_Values[i + size_t(j) * m_Width];
+		const float depth = m_MinDepth + (m_MaxDepth - m_MinDepth) * importance;
+
+		ShadingRate rate;
+		rate.m_Samples = std::max(1, (int)std::ceil(m_Samples * importance - 1e-3f));
+		rate.m_LightSamples = std::max(1, (int)std::ceil(m_LightSamples * importance - 1e-3f));
+		rate.m_Depth = (int)depth;
+		rate.m_DepthFraction = depth - rate.m_Depth;
+
+		return rate;
+	}
+
+	// Samples traced over the frame, relative to m_Samples for every pixel.
+	double SampleShare() const
+	{
+		double samples = 0.0;
+
+		for (int j = 0; j < m_Height; j++) {
+			for (int i = 0; i < m_Width; i++) samples += Rate(i, j).m_Samples;
+		}
+
+		return samples / (double(m_Samples) * m_Width * m_Height);
+	}
+
+private:
+	// Box filter of half-width "radius" along the rows or the columns, with
+	// the edge values repeated.
+	void Blur(int radius, bool rows)
+	{
+		if (radius <= 0) return;
+
+		const int lines = rows ? m_Height : m_Width, count = rows ? m_Width : m_Height;
+		const size_t step = rows ? 1 : m_Width;
+		std::vector<float> line(count);
+
+		for (int l = 0; l < lines; l++) {
+			float* values = &m_Values[rows ? size_t(l) * m_Width : l];
+			float sum = 0.0f;
+
+			for (int k = -radius - 1; k < radius; k++) sum += values[std::min(std::max(k, 0), count - 1) * step];
+
+			for (int k = 0; k < count; k++) {
+				sum += values[std::min(k + radius, count - 1) * step] - values[std::max(k - radius - 1, 0) * step];
+				line[k] = sum / (2 * radius + 1);
+			}
+
+			for (int k = 0; k < count; k++) values[k * step] = line[k];
+		}
+	}
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "Geometry.h"
+#include "Sphere.h"
+#include "Parallel.h"
+#include "RayBatch.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Closest sphere along one ray, in three versions: the scalar loop over
+// Sphere::RayIntersect that SceneIntersectClosest runs, and SSE and AVX2
+// kernels testing 4 or 8 spheres per instruction from a structure of arrays.
+// Hits count only below "tMax", which for shadow rays is the light distance.
+//
+const int NoSphere = -1;
+
+// Sphere centers and squared radii, padded to whole blocks of BatchSize.
+// Padding spheres have a huge negative squared radius, so they never hit.
+//
+struct SphereSoA
+{
+	int m_Count;
+	AlignedVector<float> m_X, m_Y, m_Z;
+	AlignedVector<float> m_RadiusSquared;
+
+	SphereSoA() : m_Count(0) {}
+
+	explicit SphereSoA(const std::vector<Sphere>& spheres)
+		: m_Count(int((spheres.size() + BatchSize - 1) / BatchSize * BatchSize))
+	{
+		m_X.assign(m_Count, 0.0f);
+		m_Y.assign(m_Count, 0.0f);
+		m_Z.assign(m_Count, 0.0f);
+		m_RadiusSquared.assign(m_Count, -std::numeric_limits<float>::max());
+
+		for (size_t i = 0; i < spheres.size(); i++) {
+			m_X[i] = spheres[i].m_Center.x;
+			m_Y[i] = spheres[i].m_Center.y;
+			m_Z[i] = spheres[i].m_Center.z;
+			m_RadiusSquared[i] = spheres[i].m_Radius * spheres[i].m_Radius;
+		}
+	}
+};
+
+inline int IntersectSpheresScalar(const std::vector<Sphere>& spheres, const Vec3f& origin, const Vec3f& direction, float tMax, float& t)
+{
+	int closest = NoSphere;
+
+	t = tMax;
+
+	for (size_t i = 0; i < spheres.size(); i++) {
+		float d;
+
+		if (spheres[i].RayIntersect(origin, direction, d) && d < t) { t = d; closest = (int)i; }
+	}
+
+	return closest;
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+inline int IntersectSpheresSse(const SphereSoA& spheres, const Vec3f& origin, const Vec3f& direction, float tMax, float& t)
+{
+	const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+	const __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+	const __m128 zero = _mm_setzero_ps();
+
+	__m128 closestT = _mm_set1_ps(tMax);
+	__m128i closestIndex = _mm_set1_epi32(NoSphere);
+	__m128i index = _mm_setr_epi32(0, 1, 2, 3);
+
+	for (int i = 0; i < spheres.m_Count; i += 4) {
+		__m128 xx = _mm_sub_ps(ox, _mm_load_ps(&spheres.m_X[i]));
+		__m128 xy = _mm_sub_ps(oy, _mm_load_ps(&spheres.m_Y[i]));
+		__m128 xz = _mm_sub_ps(oz, _mm_load_ps(&spheres.m_Z[i]));
+
+		__m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xx, dx), _mm_mul_ps(xy, dy)), _mm_mul_ps(xz, dz));
+		__m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xx, xx), _mm_mul_ps(xy, xy)), _mm_mul_ps(xz, xz));
+		__m128 delta = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b, b), c), _mm_load_ps(&spheres.m_RadiusSquared[i]));
+
+		__m128 root = _mm_sqrt_ps(_mm_max_ps(delta, zero));
+		__m128 s1 = _mm_sub_ps(_mm_sub_ps(zero, b), root);
+		__m128 s2 = _mm_add_ps(_mm_sub_ps(zero, b), root);
+
+		// The near root when it is in front of the origin, otherwise the far one.
+		__m128 near = _mm_cmpgt_ps(s1, zero);
+		__m128 s = _mm_or_ps(_mm_and_ps(near, s1), _mm_andnot_ps(near, s2));
+		__m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(delta, zero), _mm_cmpgt_ps(s, zero)), _mm_cmplt_ps(s, closestT));
+
+		closestT = _mm_or_ps(_mm_and_ps(hit, s), _mm_andnot_ps(hit, closestT));
+		closestIndex = _mm_or_si128(_mm_and_si128(_mm_castps_si128(hit), index), _mm_andnot_si128(_mm_castps_si128(hit), closestIndex));
+		index = _mm_add_epi32(index, _mm_set1_epi32(4));
+	}
+
+	alignas(16) float lanesT[4];
+	alignas(16) int lanesIndex[4];
+
+	_mm_store_ps(lanesT, closestT);
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanesIndex), closestIndex);
+
+	int closest = NoSphere;
+	t = tMax;
+
+	for (int k = 0; k < 4; k++) {
+		if (lanesIndex[k] != NoSphere && lanesT[k] < t) { t = lanesT[k]; closest = lanesIndex[k]; }
+	}
+
+	return closest;
+}
+#endif
+
+#if defined(__AVX2__)
+inline int IntersectSpheresAvx2(const SphereSoA& spheres, const Vec3f& origin, const Vec3f& direction, float tMax, float& t)
+{
+	const __m256 ox = _mm256_set1_ps(origin.x), oy = _mm256_set1_ps(origin.y), oz = _mm256_set1_ps(origin.z);
+	const __m256 dx = _mm256_set1_ps(direction.x), dy = _mm256_set1_ps(direction.y), dz = _mm256_set1_ps(direction.z);
+	const __m256 zero = _mm256_setzero_ps();
+
+	__m256 closestT = _mm256_set1_ps(tMax);
+	__m256i closestIndex = _mm256_set1_epi32(NoSphere);
+	__m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	for (int i = 0; i < spheres.m_Count; i += BatchSize) {
+		__m256 xx = _mm256_sub_ps(ox, _mm256_load_ps(&spheres.m_X[i]));
+		__m256 xy = _mm256_sub_ps(oy, _mm256_load_ps(&spheres.m_Y[i]));
+		__m256 xz = _mm256_sub_ps(oz, _mm256_load_ps(&spheres.m_Z[i]));
+
+		__m256 b = _mm256_fmadd_ps(xz, dz, _mm256_fmadd_ps(xy, dy, _mm256_mul_ps(xx, dx)));
+		__m256 c = _mm256_fmadd_ps(xz, xz, _mm256_fmadd_ps(xy, xy, _mm256_mul_ps(xx, xx)));
+		__m256 delta = _mm256_add_ps(_mm256_fmsub_ps(b, b, c), _mm256_load_ps(&spheres.m_RadiusSquared[i]));
+
+		__m256 root = _mm256_sqrt_ps(_mm256_max_ps(delta, zero));
+		__m256 s1 = _mm256_sub_ps(_mm256_sub_ps(zero, b), root);
+		__m256 s2 = _mm256_add_ps(_mm256_sub_ps(zero, b), root);
+
+		__m256 s = _mm256_blendv_ps(s2, s1, _mm256_cmp_ps(s1, zero, _CMP_GT_OQ));
+		__m256 hit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(delta, zero, _CMP_GE_OQ), _mm256_cmp_ps(s, zero, _CMP_GT_OQ)), _mm256_cmp_ps(s, closestT, _CMP_LT_OQ));
+
+		closestT = _mm256_blendv_ps(closestT, s, hit);
+		closestIndex = _mm256_blendv_epi8(closestIndex, index, _mm256_castps_si256(hit));
+		index = _mm256_add_epi32(index, _mm256_set1_epi32(BatchSize));
+	}
+
+	alignas(32) float lanesT[BatchSize];
+	alignas(32) int lanesIndex[BatchSize];
+
+	_mm256_store_ps(lanesT, closestT);
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanesIndex), closestIndex);
+
+	int closest = NoSphere;
+	t = tMax;
+
+	for (int k = 0; k < BatchSize; k++) {
+		if (lanesIndex[k] != NoSphere && lanesT[k] < t) { t = lanesT[k]; closest = lanesIndex[k]; }
+	}
+
+	return closest;
+}
+#endif
+
+// The widest of the kernels above that the build has, for traversal in
+// float; without SSE, the quadratic of IntersectSpheresScalar over the arrays.
+//
+inline int IntersectSpheres(const SphereSoA& spheres, const Vec3f& origin, const Vec3f& direction, float tMax, float& t)
+{
+#if defined(__AVX2__)
+	return IntersectSpheresAvx2(spheres, origin, direction, tMax, t);
+#elif defined(__SSE2__) || defined(_M_X64)
+	return IntersectSpheresSse(spheres, origin, direction, tMax, t);
+#else
+	int closest = NoSphere;
+
+	t = tMax;
+
+	for (int i = 0; i < spheres.m_Count; i++) {
+		Vec3f xa = origin - Vec3f(spheres.m_X[i], spheres.m_Y[i], spheres.m_Z[i]);
+		float b = xa * direction;
+		float delta = (b * b) - (xa * xa) + spheres.m_RadiusSquared[i];
+
+		if (delta < 0) continue;
+
+		float s1 = - b - std::sqrt(delta), s2 = - b + std::sqrt(delta);
+		float d = s1 > 0 ? s1 : s2;
+
+		if (d > 0 && d < t) { t = d; closest = i; }
+	}
+
+	return closest;
+#endif
+}
@@ -6,7 +6,8 @@ struct Light
 {
 	Vec3f m_Position;
 	float m_Intensity;
+	float m_Radius; // Zero for a point light, otherwise a spherical area light.
 
-	Light(const Vec3f& position, const float intensity)
-		: m_Position(position), m_Intensity(intensity) {}
+	Light(const Vec3f& position, const float intensity, const float radius = 0.0f)
+		: m_Position(position), m_Intensity(intensity), m_Radius(radius) {}
 };
\ No newline at end of file
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include "Geometry.h"
+#include "Light.h"
+#include "Parallel.h"
+#include "RayBatch.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// The scene lights as structure of arrays, padded to whole blocks of
+// BatchSize lights, so one hit is shaded against 8 lights per instruction.
+// Padding lanes have no intensity and are never part of a lane mask.
+//
+struct LightSet
+{
+	std::vector<Light> m_Lights;
+
+	int m_Blocks;
+	AlignedVector<float> m_X, m_Y, m_Z;
+	AlignedVector<float> m_Intensity;
+	AlignedVector<float> m_Radius;
+
+	explicit LightSet(const std::vector<Light>& lights)
+		: m_Lights(lights), m_Blocks(int((lights.size() + BatchSize - 1) / BatchSize))
+	{
+		size_t padded = size_t(m_Blocks) * BatchSize;
+
+		m_X.assign(padded, 0.0f);
+		m_Y.assign(padded, 1.0f); // Keeps padding directions finite.
+		m_Z.assign(padded, 0.0f);
+		m_Intensity.assign(padded, 0.0f);
+		m_Radius.assign(padded, 0.0f);
+
+		for (size_t i = 0; i < lights.size(); i++) {
+			m_X[i] = lights[i].m_Position.x;
+			m_Y[i] = lights[i].m_Position.y;
+			m_Z[i] = lights[i].m_Position.z;
+			m_Intensity[i] = lights[i].m_Intensity;
+			m_Radius[i] = lights[i].m_Radius;
+		}
+	}
+
+	size_t size() const { return m_Lights.size(); }
+
+	// Lanes of "block" that hold a real light.
+	int ValidMask(int block) const
+	{
+		int count = (int)m_Lights.size() - block * BatchSize;
+
+		return count >= BatchSize ? BatchFullMask : (1 << count) - 1;
+	}
+};
+
+// One hit against one block of lights: unit directions and distances to the
+// lights, cos(light, normal) and cos(light, mirrored view direction).
+//
+struct alignas(32) LightLanes
+{
+	float m_X[BatchSize];
+	float m_Y[BatchSize];
+	float m_Z[BatchSize];
+	float m_Distance[BatchSize];
+	float m_Diffuse[BatchSize];
+	float m_Specular[BatchSize];
+};
+
+// Any precision: the lane directions are unit vectors, so float is enough once
+// the difference to the light has been taken in T.
+//
+template <typename T> void ComputeLightLanes(const LightSet& lights, int block, const vec<3, T>& point, const vec<3, T>& normal, const vec<3, T>& direction, LightLanes& lanes)
+{
+	const float* px = &lights.m_X[block * BatchSize];
+	const float* py = &lights.m_Y[block * BatchSize];
+	const float* pz = &lights.m_Z[block * BatchSize];
+
+	// Reflect(l, n) * d = l * d - 2 (l * n) (n * d), so the reflection is never built.
+	const T nd = normal * direction;
+
+	for (int i = 0; i < BatchSize; i++) {
+		T lx = px[i] - point.x, ly = py[i] - point.y, lz = pz[i] - point.z;
+		T distance = std::sqrt(lx * lx + ly * ly + lz * lz);
+		T inverse = T(1) / distance;
+
+		lx *= inverse;
+		ly *= inverse;
+		lz *= inverse;
+
+		T ln = lx * normal.x + ly * normal.y + lz * normal.z;
+		T ld = lx * direction.x + ly * direction.y + lz * direction.z;
+
+		lanes.m_X[i] = float(lx);
+		lanes.m_Y[i] = float(ly);
+		lanes.m_Z[i] = float(lz);
+		lanes.m_Distance[i] = float(distance);
+		lanes.m_Diffuse[i] = float(ln);
+		lanes.m_Specular[i] = float(ld - 2 * ln * nd);
+	}
+}
+
+inline void ComputeLightLanes(const LightSet& lights, int block, const Vec3f& point, const Vec3f& normal, const Vec3f& direction, LightLanes& lanes)
+{
+#if defined(__AVX__)
+	const float* px = &lights.m_X[block * BatchSize];
+	const float* py = &lights.m_Y[block * BatchSize];
+	const float* pz = &lights.m_Z[block * BatchSize];
+
+	const float nd = normal * direction;
+
+	__m256 lx = _mm256_sub_ps(_mm256_load_ps(px), _mm256_set1_ps(point.x));
+	__m256 ly = _mm256_sub_ps(_mm256_load_ps(py), _mm256_set1_ps(point.y));
+	__m256 lz = _mm256_sub_ps(_mm256_load_ps(pz), _mm256_set1_ps(point.z));
+
+	__m256 distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx), _mm256_mul_ps(ly, ly)), _mm256_mul_ps(lz, lz)));
+	__m256 inverse = _mm256_div_ps(_mm256_set1_ps(1.0f), distance);
+
+	lx = _mm256_mul_ps(lx, inverse);
+	ly = _mm256_mul_ps(ly, inverse);
+	lz = _mm256_mul_ps(lz, inverse);
+
+	__m256 ln = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, _mm256_set1_ps(normal.x)), _mm256_mul_ps(ly, _mm256_set1_ps(normal.y))), _mm256_mul_ps(lz, _mm256_set1_ps(normal.z)));
+	__m256 ld = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, _mm256_set1_ps(direction.x)), _mm256_mul_ps(ly, _mm256_set1_ps(direction.y))), _mm256_mul_ps(lz, _mm256_set1_ps(direction.z)));
+
+	_mm256_store_ps(lanes.m_X, lx);
+	_mm256_store_ps(lanes.m_Y, ly);
+	_mm256_store_ps(lanes.m_Z, lz);
+	_mm256_store_ps(lanes.m_Distance, distance);
+	_mm256_store_ps(lanes.m_Diffuse, ln);
+	_mm256_store_ps(lanes.m_Specular, _mm256_sub_ps(ld, _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), ln), _mm256_set1_ps(nd))));
+#else
+	ComputeLightLanes<float>(lights, block, point, normal, direction, lanes);
+#endif
+}
+
+// Lanes whose light can contribute at all: in front of the surface or inside the specular lobe.
+inline int ContributingMask(const LightLanes& lanes)
+{
+	int mask = 0;
+
+	for (int i = 0; i < BatchSize; i++) {
+		mask |= (lanes.m_Diffuse[i] > 0.0f || lanes.m_Specular[i] > 0.0f) << i;
+	}
+
+	return mask;
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+#include "Geometry.h"
+#include "Sampling.h"
+
+// GGX microfacet model with height-correlated Smith visibility and Schlick
+// Fresnel. Single scattering loses energy at high roughness; it is given back
+// with the directional albedo tabulated below (Fdez-Aguera, "A Multiple-
+// Scattering Microfacet Model for Real-Time Image-based Lighting").
+//
+const int DfgTableSize = 32;
+const int DfgTableSamples = 256;
+
+// Directional albedo of the GGX lobe, split as F0 * A + B by the Schlick
+// Fresnel term, for cos(theta) and roughness in [0, 1].
+//
+struct DfgTable
+{
+	float m_A[DfgTableSize][DfgTableSize]; // [roughness][cosTheta]
+	float m_B[DfgTableSize][DfgTableSize];
+
+	DfgTable()
+	{
+		for (int r = 0; r < DfgTableSize; r++) {
+			for (int c = 0; c < DfgTableSize; c++) {
+				Integrate(CosThetaAt(c), RoughnessAt(r), m_A[r][c], m_B[r][c]);
+			}
+		}
+	}
+
+	static float CosThetaAt(int c) { return std::max(1e-3f, c / float(DfgTableSize - 1)); }
+	static float RoughnessAt(int r) { return std::max(1e-2f, r / float(DfgTableSize - 1)); }
+
+	// Importance sampled on the GGX normal distribution, with a Hammersley set.
+	static void Integrate(float cosTheta, float roughness, float& a, float& b)
+	{
+		const float alpha = roughness * roughness;
+		const Vec3f v(std::sqrt(1.0f - cosTheta * cosTheta), 0.0f, cosTheta);
+
+		a = b = 0.0f;
+
+		for (unsigned i = 0; i < (unsigned)DfgTableSamples; i++) {
+			unsigned bits = i;
+			bits = (bits << 16u) | (bits >> 16u);
+			bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+			bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+			bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+			bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+
+			float u1 = (i + 0.5f) / DfgTableSamples;
+			float u2 = bits * 2.3283064365386963e-10f;
+
+			float cosH = std::sqrt((1.0f - u1) / (1.0f + (alpha * alpha - 1.0f) * u1));
+			float sinH = std::sqrt(1.0f - cosH * cosH);
+			Vec3f h(sinH * std::cos(2.0f * Pi * u2), sinH * std::sin(2.0f * Pi * u2), cosH);
+
+			float vh = v * h;
+			Vec3f l = h * (2.0f * vh) - v;
+
+			if (l.z <= 0.0f || vh <= 0.0f) continue;
+
+			// weight = f * cos / pdf, with pdf = D * nh / (4 vh) and f = D * Vis * F.
+			float weight = SmithVisibility(cosTheta, l.z, alpha) * 4.0f * vh * l.z / cosH;
+			float fc = std::pow(1.0f - vh, 5.0f);
+
+			a += (1.0f - fc) * weight;
+			b += fc * weight;
+		}
+
+		a /= DfgTableSamples;
+		b /= DfgTableSamples;
+	}
+
+	static float SmithVisibility(float nv, float nl, float alpha)
+	{
+		float a2 = alpha * alpha;
+		float gv = nl * std::sqrt(nv * nv * (1.0f - a2) + a2);
+		float gl = nv * std::sqrt(nl * nl * (1.0f - a2) + a2);
+
+		return 0.5f / (gv + gl);
+	}
+
+	// Bilinear lookup; returns A and B.
+	void Lookup(float cosTheta, float roughness, float& a, float& b) const
+	{
+		float x = std::min(std::max(cosTheta, 0.0f), 1.0f) * (DfgTableSize - 1);
+		float y = std::min(std::max(roughness, 0.0f), 1.0f) * (DfgTableSize - 1);
+
+		int x0 = std::min((int)x, DfgTableSize - 2), y0 = std::min((int)y, DfgTableSize - 2);
+		float fx = x - x0, fy = y - y0;
+
+		a = (m_A[y0][x0] * (1 - fx) + m_A[y0][x0 + 1] * fx) * (1 - fy) + (m_A[y0 + 1][x0] * (1 - fx) + m_A[y0 + 1][x0 + 1] * fx) * fy;
+		b = (m_B[y0][x0] * (1 - fx) + m_B[y0][x0 + 1] * fx) * (1 - fy) + (m_B[y0 + 1][x0] * (1 - fx) + m_B[y0 + 1][x0 + 1] * fx) * fy;
+	}
+
+	// Built once, on first use.
+	static const DfgTable& Get()
+	{
+		static const DfgTable table;
+
+		return table;
+	}
+};
+
+// Per-hit terms shared by all lights.
+struct MicrofacetSurface
+{
+	Vec3f m_Normal;
+	Vec3f m_View;             // Toward the viewer.
+	float m_NormalDotView;
+	float m_Alpha;            // GGX alpha = roughness^2.
+	Vec3f m_F0;
+	Vec3f m_EnergyCompensation;
+	Vec3f m_DirectionalAlbedo; // F0 * A + B, with the compensation applied.
+
+	MicrofacetSurface(const Vec3f& normal, const Vec3f& direction, float roughness, const Vec3f& f0)
+		: m_Normal(normal), m_View(-direction), m_Alpha(roughness * roughness), m_F0(f0)
+	{
+		m_NormalDotView = std::max(1e-4f, m_View * m_Normal);
+
+		float a, b;
+		DfgTable::Get().Lookup(m_NormalDotView, roughness, a, b);
+
+		for (size_t i = 0; i < 3; i++) {
+			m_EnergyCompensation[i] = 1.0f + f0[i] * (1.0f / (a + b) - 1.0f);
+			m_DirectionalAlbedo[i] = (f0[i] * a + b) * m_EnergyCompensation[i];
+		}
+	}
+};
+
+// Specular contribution of "count" lights, passed as structure of arrays of
+// unit directions and intensities. The loop has no branches so compilers
+// vectorize it. The Schlick term is kept as (1 - Fc, Fc) sums, which the
+// caller combines with F0: specular = F0 * sums[0] + sums[1].
+//
+inline void EvaluateGgxLights(const MicrofacetSurface& surface, const float* lx, const float* ly, const float* lz,
+                              const float* intensity, int count, float& sumA, float& sumB, float& diffuse)
+{
+	const float nx = surface.m_Normal.x, ny = surface.m_Normal.y, nz = surface.m_Normal.z;
+	const float vx = surface.m_View.x, vy = surface.m_View.y, vz = surface.m_View.z;
+	const float nv = surface.m_NormalDotView;
+	const float a2 = surface.m_Alpha * surface.m_Alpha;
+
+	float a = 0.0f, b = 0.0f, d = 0.0f;
+
+	for (int i = 0; i < count; i++) {
+		float nl = std::max(0.0f, nx * lx[i] + ny * ly[i] + nz * lz[i]);
+
+		float hx = lx[i] + vx, hy = ly[i] + vy, hz = lz[i] + vz;
+		float invLength = 1.0f / std::sqrt(std::max(1e-8f, hx * hx + hy * hy + hz * hz));
+		float nh = std::max(0.0f, (nx * hx + ny * hy + nz * hz) * invLength);
+		float vh = std::max(0.0f, (vx * hx + vy * hy + vz * hz) * invLength);
+
+		float k = nh * nh * (a2 - 1.0f) + 1.0f;
+		float distribution = a2 / (Pi * k * k);
+
+		float gv = nl * std::sqrt(nv * nv * (1.0f - a2) + a2);
+		float gl = nv * std::sqrt(nl * nl * (1.0f - a2) + a2);
+		float visibility = 0.5f / std::max(1e-8f, gv + gl);
+
+		float m = 1.0f - vh, m2 = m * m;
+		float fc = m2 * m2 * m;
+
+		// Lights are not divided by pi in this renderer (diffuse is I * cos), hence the pi.
+		float specular = Pi * distribution * visibility * nl * intensity[i];
+
+		a += specular * (1.0f - fc);
+		b += specular * fc;
+		d += nl * intensity[i];
+	}
+
+	sumA += a;
+	sumB += b;
+	diffuse += d;
+}
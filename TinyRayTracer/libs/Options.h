@@ -0,0 +1,440 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cfloat>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "Sampling.h"
+#include "SceneGenerator.h"
+#include "FrameStream.h"
+#include "AsyncWriter.h"
+#include "Bake.h"
+
+enum Precision
+{
+	FloatPrecision,
+	DoublePrecision,
+	MixedPrecision, // Double positions, float eye-relative traversal, closest hit refined in double.
+};
+
+enum Integrator
+{
+	WhittedIntegrator, // CastRay: lights, shadows, reflection and refraction.
+	AoIntegrator,      // Ambient occlusion of the primary hits, for previews.
+};
+
+struct Options
+{
+	int m_Threads;         // 0 keeps the OpenMP default.
+	bool m_Batched;        // Trace BatchSize rays per call through CastRayBatch.
+	int m_SamplesPerPixel;
+	float m_LightRadius;   // Turns the scene lights into spherical area lights.
+	int m_LightSamples;
+	MisHeuristic m_Heuristic;
+	bool m_Microfacet;     // GGX versions of the default scene materials.
+	Precision m_Precision;
+	Integrator m_Integrator;
+	int m_AoSamples;       // Occlusion rays per primary hit.
+	float m_AoDistance;    // Occluders farther than this are ignored.
+	bool m_Focus;          // Importance falls off around m_FocusPoint: x, y, radius in pixels.
+	float m_FocusPoint[3];
+	const char* m_Importance; // Importance from this PGM/PPM, when set.
+	float m_ImportanceFloor;  // Importance of the least important pixels.
+	int m_MinDepth;           // Ray depth at importance 0.
+	bool m_Checkerboard;   // Trace half of the pixels per frame and reconstruct the others.
+	int m_Upscale;         // Shade at 1 / m_Upscale of the resolution and upsample, when above 1.
+	float m_WorldOffset;   // Moves the whole scene, to test precision far from the origin.
+	bool m_Heatmap;        // Also write per-pixel cost heatmaps.
+	const char* m_Trace;   // Chrome trace JSON of the run, when set.
+	bool m_PerfCounters;   // Hardware counters per stage and thread (Linux perf_event).
+	bool m_Energy;         // Report the energy of the frame (Linux RAPL).
+	bool m_Crop;           // Trace only m_CropRect: x0, y0, x1, y1, half-open.
+	int m_CropRect[4];
+	const char* m_Mask;    // Trace only the non-zero pixels of this PGM/PPM, when set.
+	const char* m_Merge;   // Image the crop or mask is merged into (default the previous output).
+	const char* m_Checkpoint;   // Render in sample passes and save progress here, when set.
+	float m_CheckpointInterval; // Seconds between checkpoints.
+	bool m_Resume;              // Continue from m_Checkpoint.
+	const char* m_Stream;  // Frames go to this file or pipe ("-": stdout) instead of outputs/image.ppm.
+	StreamFormat m_StreamFormat;
+	int m_Frames;          // Frames of the camera animation.
+	int m_FrameRate;
+	const char* m_Shm;     // Render into this POSIX shared memory object ("/name") instead.
+	OutputBackend m_OutputBackend; // How --frames writes its files.
+	int m_OutputDepth;     // Frames queued or being written at most.
+	bool m_Bake;           // Bake lightmaps and irradiance probes instead of rendering.
+	int m_BakeSize;        // Lightmap width in texels.
+	int m_BakeSamples;     // Indirect samples per texel; probes take four times as many.
+	int m_ProbeGrid;       // Probes per axis.
+	const char* m_Diff[2]; // Compare these two images instead of rendering, when set.
+	SceneKind m_Scene;
+	int m_SceneSize;       // 0 picks the default size of the scene kind.
+	unsigned m_Seed;
+	bool m_BenchScaling;   // Thread scaling microbenchmark instead of a single render.
+	bool m_BenchPrecision; // Float, mixed and double renders compared.
+	bool m_BenchIntersect; // Intersection kernels alone, on synthetic rays.
+	int m_BenchRepeats;
+	bool m_PerfCheck;      // Compare with the stored baseline, exit code 1 on regression.
+	bool m_PerfBaseline;   // Store this run as the new baseline.
+	const char* m_PerfHistory;
+	float m_PerfThreshold; // Percent of Render throughput.
+
+	Options()
+		: m_Threads(0), m_Batched(false), m_SamplesPerPixel(1), m_LightRadius(0.0f), m_LightSamples(1), m_Heuristic(MisPower), m_Microfacet(false), m_Precision(FloatPrecision), m_Integrator(WhittedIntegrator), m_AoSamples(16), m_AoDistance(1.5f), m_Focus(false), m_Importance(NULL), m_ImportanceFloor(0.1f), m_MinDepth(2), m_Checkerboard(false), m_Upscale(1), m_WorldOffset(0.0f), m_Heatmap(false), m_Trace(NULL), m_PerfCounters(false), m_Energy(false), m_Crop(false), m_Mask(NULL), m_Merge(NULL), m_Checkpoint(NULL), m_CheckpointInterval(60.0f), m_Resume(false), m_Stream(NULL), m_StreamFormat(StreamY4m), m_Frames(1), m_FrameRate(30), m_Shm(NULL), m_OutputBackend(OutputUring), m_OutputDepth(4), m_Bake(false), m_BakeSize(128), m_BakeSamples(64), m_ProbeGrid(8), m_Scene(DefaultScene), m_SceneSize(0), m_Seed(1), m_BenchScaling(false), m_BenchPrecision(false), m_BenchIntersect(false), m_BenchRepeats(3),
+		  m_PerfCheck(false), m_PerfBaseline(false), m_PerfHistory("outputs/perf-history.txt"), m_PerfThreshold(3.0f)
+	{
+		for (int k = 0; k < 4; k++) m_CropRect[k] = 0;
+		for (int k = 0; k < 3; k++) m_FocusPoint[k] = 0.0f;
+		for (int k = 0; k < 2; k++) m_Diff[k] = NULL;
+	}
+};
+
+inline void PrintUsage(const char* program)
+{
+	std::cerr << "Usage: " << program << " [options]\n"
+	          << "  --threads N         Number of render threads.\n"
+	          << "  --batched           Trace packets of 8 rays with the batched kernels.\n"
+	          << "  --spp N             Samples per pixel (jittered when above 1).\n"
+	          << "  --light-radius R    Render the lights as spheres of radius R.\n"
+	          << "  --light-samples N   Samples per area light and strategy.\n"
+	          << "  --mis H             power, balance, light or lobe (default power).\n"
+	          << "  --microfacet        Use GGX conductor/dielectric materials.\n"
+	          << "  --precision P       float, double or mixed (default float).\n"
+	          << "  --integrator I      whitted (default) or ao, ambient occlusion for quick previews.\n"
+	          << "  --ao-samples N      Occlusion rays per hit for --integrator ao (default 16).\n"
+	          << "  --ao-distance D     Largest distance an occluder counts at (default 1.5).\n"
+	          << "  --focus X Y R       Full quality within R pixels of (X, Y), less and less up to 2R away.\n"
+	          << "  --importance F      Scale quality by the PGM/PPM F, white for full quality.\n"
+	          << "  --importance-floor V  Importance of the least important pixels (default 0.1).\n"
+	          << "  --min-depth N       Ray depth at importance 0 (default 2, full quality 5).\n"
+	          << "  --checkerboard      Trace half of the pixels per frame, alternating, and reconstruct the rest.\n"
+	          << "  --upscale N         Shade at 1/N resolution (2 or 4) and upsample along full resolution edges.\n"
+	          << "  --world-offset D    Translate the scene and camera by (D, D, D).\n"
+	          << "  --heatmap           Write rays, tests and cycles per pixel as heatmaps in outputs/.\n"
+	          << "  --trace F           Write a Chrome/Perfetto timeline of threads and tiles to F.\n"
+	          << "  --perf-counters     Report cycles, instructions, cache and branch misses per stage and thread.\n"
+	          << "  --energy            Report joules per frame and rays per joule from RAPL counters.\n"
+	          << "  --crop X0 Y0 X1 Y1  Trace only pixels in [X0, X1) x [Y0, Y1) and merge them into an image.\n"
+	          << "  --mask F            Trace only the non-zero pixels of the PGM/PPM F, merged likewise.\n"
+	          << "  --merge F           Image to merge into (default outputs/image.ppm, the previous render).\n"
+	          << "  --checkpoint F      Render one sample per pixel at a time, saving progress to F.\n"
+	          << "  --checkpoint-interval S  Seconds between checkpoints (default 60).\n"
+	          << "  --resume            Continue from the --checkpoint file, if there is one.\n"
+	          << "  --stream F          Write every frame to F as it completes; \"-\" is stdout.\n"
+	          << "  --stream-format S   y4m (YUV 4:2:0, default) or ppm.\n"
+	          << "  --shm NAME          Render into the POSIX shared memory object NAME (\"/trt\") for other processes.\n"
+	          << "  --frames N          Frames of a camera sway animation, to outputs/frame-NNNN.ppm unless streamed.\n"
+	          << "  --output-backend B  uring (default, falls back to threads), threads or sync, for --frames.\n"
+	          << "  --output-depth N    Frames written in the background at most (default 4).\n"
+	          << "  --fps N             Frame rate in the Y4M header (default 30).\n"
+	          << "  --bake              Bake lightmaps of the plane and spheres and SH probes to outputs/*.pfm.\n"
+	          << "  --bake-size N       Lightmap width in texels (default 128).\n"
+	          << "  --bake-samples N    Indirect samples per texel (default 64, probes 4x).\n"
+	          << "  --probe-grid N      Probes per axis of the grid (default 8, at most 256).\n"
+	          << "  --diff A B          Compare two PPM/PGM images and write outputs/diff.pgm.\n"
+	          << "  --scene S           default, flake, random, clustered, grid or lights.\n"
+	          << "  --scene-size N      Depth (flake), spheres (random, clustered), grid side or lights.\n"
+	          << "  --seed N            Seed of the generated scene (default 1).\n"
+	          << "  --bench-scaling     Measure render and counter scaling over thread counts.\n"
+	          << "  --bench-precision   Compare float, mixed and double renders.\n"
+	          << "  --bench-intersect   Time the sphere and plane intersection kernels alone.\n"
+	          << "  --bench-repeats N   Renders per measurement (default 3).\n"
+	          << "  --perf-check        Compare throughput with the stored baseline; fails on a regression.\n"
+	          << "  --perf-baseline     Store this perf-check run as the new baseline.\n"
+	          << "  --perf-history F    History file (default outputs/perf-history.txt).\n"
+	          << "  --perf-threshold P  Largest accepted throughput drop, in percent (default 3).\n";
+}
+
+// Numeric values: the whole argument must be a number in [low, high], or the
+// option is refused like an unknown one. atoi() would read "abc" as 0.
+//
+inline bool ParseInt(const char* text, int& value, int low = INT_MIN, int high = INT_MAX)
+{
+	char* end;
+	errno = 0;
+	long number = strtol(text, &end, 10);
+
+	if (end == text || *end || errno == ERANGE || number < low || number > high) return false;
+
+	value = (int)number;
+
+	return true;
+}
+
+inline bool ParseUnsigned(const char* text, unsigned& value)
+{
+	char* end;
+	errno = 0;
+	unsigned long number = strtoul(text, &end, 10);
+
+	if (end == text || *end || *text == '-' || errno == ERANGE || number > UINT_MAX) return false;
+
+	value = (unsigned)number;
+
+	return true;
+}
+
+inline bool ParseFloat(const char* text, float& value, float low = -FLT_MAX, float high = FLT_MAX)
+{
+	char* end;
+	double number = strtod(text, &end);
+
+	if (end == text || *end || !std::isfinite(number) || number < low || number > high) return false;
+
+	value = (float)number;
+
+	return true;
+}
+
+// "count" values from "texts", all or none.
+template <typename T, typename Parse> bool ParseAll(char* texts[], int count, T* values, Parse parse)
+{
+	T parsed[4];
+
+	for (int k = 0; k < count; k++) {
+		if (!parse(texts[k], parsed[k])) return false;
+	}
+
+	for (int k = 0; k < count; k++) values[k] = parsed[k];
+
+	return true;
+}
+
+// Only the factors whose low resolution frame divides 1024 x 768 evenly.
+inline bool ParseUpscale(const char* text, int& factor)
+{
+	int value;
+
+	if (!ParseInt(text, value, 2, 4) || value == 3) return false;
+
+	factor = value;
+
+	return true;
+}
+
+inline bool ParseHeuristic(const char* name, MisHeuristic& heuristic)
+{
+	if (!strcmp(name, "power")) heuristic = MisPower;
+	else if (!strcmp(name, "balance")) heuristic = MisBalance;
+	else if (!strcmp(name, "light")) heuristic = MisLightOnly;
+	else if (!strcmp(name, "lobe")) heuristic = MisLobeOnly;
+	else return false;
+
+	return true;
+}
+
+inline bool ParsePrecision(const char* name, Precision& precision)
+{
+	if (!strcmp(name, "float")) precision = FloatPrecision;
+	else if (!strcmp(name, "double")) precision = DoublePrecision;
+	else if (!strcmp(name, "mixed")) precision = MixedPrecision;
+	else return false;
+
+	return true;
+}
+
+inline bool ParseIntegrator(const char* name, Integrator& integrator)
+{
+	if (!strcmp(name, "whitted")) integrator = WhittedIntegrator;
+	else if (!strcmp(name, "ao")) integrator = AoIntegrator;
+	else return false;
+
+	return true;
+}
+
+inline bool ParseStreamFormat(const char* name, StreamFormat& format)
+{
+	if (!strcmp(name, "y4m")) format = StreamY4m;
+	else if (!strcmp(name, "ppm")) format = StreamPpm;
+	else return false;
+
+	return true;
+}
+
+inline bool ParseOutputBackend(const char* name, OutputBackend& backend)
+{
+	if (!strcmp(name, "uring")) backend = OutputUring;
+	else if (!strcmp(name, "threads")) backend = OutputThreads;
+	else if (!strcmp(name, "sync")) backend = OutputSync;
+	else return false;
+
+	return true;
+}
+
+inline bool Incompatible(const char* first, const char* second)
+{
+	std::cerr << first << " and " << second << " cannot be combined.\n";
+
+	return false;
+}
+
+// Run() picks one mode; options that only some modes honour are refused with
+// the others rather than silently dropped.
+//
+inline bool CheckCombinations(const Options& options)
+{
+	struct Mode
+	{
+		const char* m_Name;
+		bool m_Set;
+	};
+
+	const Mode modes[] = {
+		{ "--bench-scaling", options.m_BenchScaling },
+		{ "--perf-check", options.m_PerfCheck },
+		{ "--bench-intersect", options.m_BenchIntersect },
+		{ "--bench-precision", options.m_BenchPrecision },
+		{ "--diff", options.m_Diff[0] != NULL },
+		{ "--bake", options.m_Bake },
+		{ options.m_Crop ? "--crop" : "--mask", options.m_Crop || options.m_Mask },
+		{ "--checkpoint", options.m_Checkpoint != NULL },
+		{ "--stream", options.m_Stream != NULL },
+		{ "--shm", options.m_Shm != NULL },
+		{ options.m_Focus ? "--focus" : "--importance", options.m_Focus || options.m_Importance },
+		{ "--upscale", options.m_Upscale > 1 },
+	};
+	const char* mode = NULL;
+
+	for (size_t k = 0; k < sizeof(modes) / sizeof(modes[0]); k++) {
+		if (!modes[k].m_Set) continue;
+		if (mode) return Incompatible(mode, modes[k].m_Name);
+
+		mode = modes[k].m_Name;
+	}
+
+	// Sequences are written to files, streamed or shared.
+	const bool sequence = options.m_Frames > 1;
+
+	if (sequence && mode && !options.m_Stream && !options.m_Shm) return Incompatible(mode, "--frames");
+
+	// Checkerboard rendering works on single frames and sequences, written or
+	// streamed, and reports neither cost maps nor counters.
+	if (options.m_Checkerboard)
+	{
+		if (mode && !options.m_Stream) return Incompatible(mode, "--checkerboard");
+		if (options.m_Heatmap) return Incompatible("--checkerboard", "--heatmap");
+		if (options.m_PerfCounters) return Incompatible("--checkerboard", "--perf-counters");
+	}
+
+	// Cost maps and counter reports come from single frames; the foveated
+	// render draws its own heat maps.
+	const bool foveated = options.m_Focus || options.m_Importance;
+
+	if (options.m_Heatmap && ((mode && !foveated) || sequence)) return Incompatible(mode ? mode : "--frames", "--heatmap");
+
+	const bool counted = !mode || options.m_BenchScaling || options.m_PerfCheck || options.m_BenchIntersect;
+
+	if (options.m_PerfCounters && (!counted || sequence)) return Incompatible(mode ? mode : "--frames", "--perf-counters");
+
+	// Every render mode meters its frames, and the scaling and precision
+	// benchmarks their runs; the others render no frame to measure.
+	if (options.m_Energy && (options.m_PerfCheck || options.m_BenchIntersect || options.m_Diff[0] || options.m_Bake)) return Incompatible(mode, "--energy");
+
+	return true;
+}
+
+inline bool ParseOptions(int argc, char* argv[], Options& options)
+{
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (!strcmp(arg, "--threads") && hasValue && ParseInt(argv[i + 1], options.m_Threads, 0)) i++;
+		else if (!strcmp(arg, "--batched")) options.m_Batched = true;
+		else if (!strcmp(arg, "--spp") && hasValue && ParseInt(argv[i + 1], options.m_SamplesPerPixel, 1)) i++;
+		else if (!strcmp(arg, "--light-radius") && hasValue && ParseFloat(argv[i + 1], options.m_LightRadius, 0.0f)) i++;
+		else if (!strcmp(arg, "--light-samples") && hasValue && ParseInt(argv[i + 1], options.m_LightSamples, 1)) i++;
+		else if (!strcmp(arg, "--mis") && hasValue && ParseHeuristic(argv[i + 1], options.m_Heuristic)) i++;
+		else if (!strcmp(arg, "--microfacet")) options.m_Microfacet = true;
+		else if (!strcmp(arg, "--precision") && hasValue && ParsePrecision(argv[i + 1], options.m_Precision)) i++;
+		else if (!strcmp(arg, "--integrator") && hasValue && ParseIntegrator(argv[i + 1], options.m_Integrator)) i++;
+		else if (!strcmp(arg, "--ao-samples") && hasValue && ParseInt(argv[i + 1], options.m_AoSamples, 1)) i++;
+		else if (!strcmp(arg, "--ao-distance") && hasValue && ParseFloat(argv[i + 1], options.m_AoDistance, 0.0f)) i++;
+		else if (!strcmp(arg, "--focus") && i + 3 < argc && ParseAll(argv + i + 1, 3, options.m_FocusPoint, [](const char* text, float& value) { return ParseFloat(text, value); }))
+		{
+			options.m_Focus = true;
+			i += 3;
+		}
+		else if (!strcmp(arg, "--importance") && hasValue) options.m_Importance = argv[++i];
+		else if (!strcmp(arg, "--importance-floor") && hasValue && ParseFloat(argv[i + 1], options.m_ImportanceFloor, 0.0f, 1.0f)) i++;
+		else if (!strcmp(arg, "--min-depth") && hasValue && ParseInt(argv[i + 1], options.m_MinDepth, 1)) i++;
+		else if (!strcmp(arg, "--checkerboard")) options.m_Checkerboard = true;
+		else if (!strcmp(arg, "--upscale") && hasValue && ParseUpscale(argv[i + 1], options.m_Upscale)) i++;
+		else if (!strcmp(arg, "--world-offset") && hasValue && ParseFloat(argv[i + 1], options.m_WorldOffset)) i++;
+		else if (!strcmp(arg, "--heatmap")) options.m_Heatmap = true;
+		else if (!strcmp(arg, "--trace") && hasValue) options.m_Trace = argv[++i];
+		else if (!strcmp(arg, "--perf-counters")) options.m_PerfCounters = true;
+		else if (!strcmp(arg, "--energy")) options.m_Energy = true;
+		else if (!strcmp(arg, "--crop") && i + 4 < argc && ParseAll(argv + i + 1, 4, options.m_CropRect, [](const char* text, int& value) { return ParseInt(text, value); }))
+		{
+			options.m_Crop = true;
+			i += 4;
+		}
+		else if (!strcmp(arg, "--mask") && hasValue) options.m_Mask = argv[++i];
+		else if (!strcmp(arg, "--merge") && hasValue) options.m_Merge = argv[++i];
+		else if (!strcmp(arg, "--checkpoint") && hasValue) options.m_Checkpoint = argv[++i];
+		else if (!strcmp(arg, "--checkpoint-interval") && hasValue && ParseFloat(argv[i + 1], options.m_CheckpointInterval, 0.0f)) i++;
+		else if (!strcmp(arg, "--resume")) options.m_Resume = true;
+		else if (!strcmp(arg, "--stream") && hasValue) options.m_Stream = argv[++i];
+		else if (!strcmp(arg, "--stream-format") && hasValue && ParseStreamFormat(argv[i + 1], options.m_StreamFormat)) i++;
+		else if (!strcmp(arg, "--frames") && hasValue && ParseInt(argv[i + 1], options.m_Frames, 1)) i++;
+		else if (!strcmp(arg, "--fps") && hasValue && ParseInt(argv[i + 1], options.m_FrameRate, 1)) i++;
+		else if (!strcmp(arg, "--shm") && hasValue) options.m_Shm = argv[++i];
+		else if (!strcmp(arg, "--output-backend") && hasValue && ParseOutputBackend(argv[i + 1], options.m_OutputBackend)) i++;
+		else if (!strcmp(arg, "--output-depth") && hasValue && ParseInt(argv[i + 1], options.m_OutputDepth, 1)) i++;
+		else if (!strcmp(arg, "--bake")) options.m_Bake = true;
+		else if (!strcmp(arg, "--bake-size") && hasValue && ParseInt(argv[i + 1], options.m_BakeSize, 1)) i++;
+		else if (!strcmp(arg, "--bake-samples") && hasValue && ParseInt(argv[i + 1], options.m_BakeSamples, 1)) i++;
+		else if (!strcmp(arg, "--probe-grid") && hasValue && ParseInt(argv[i + 1], options.m_ProbeGrid, 1, MaxProbeGrid)) i++;
+		else if (!strcmp(arg, "--diff") && i + 2 < argc)
+		{
+			options.m_Diff[0] = argv[++i];
+			options.m_Diff[1] = argv[++i];
+		}
+		else if (!strcmp(arg, "--scene") && hasValue && ParseSceneKind(argv[i + 1], options.m_Scene)) i++;
+		else if (!strcmp(arg, "--scene-size") && hasValue && ParseInt(argv[i + 1], options.m_SceneSize, 0)) i++;
+		else if (!strcmp(arg, "--seed") && hasValue && ParseUnsigned(argv[i + 1], options.m_Seed)) i++;
+		else if (!strcmp(arg, "--bench-scaling")) options.m_BenchScaling = true;
+		else if (!strcmp(arg, "--bench-precision")) options.m_BenchPrecision = true;
+		else if (!strcmp(arg, "--bench-intersect")) options.m_BenchIntersect = true;
+		else if (!strcmp(arg, "--bench-repeats") && hasValue && ParseInt(argv[i + 1], options.m_BenchRepeats, 1)) i++;
+		else if (!strcmp(arg, "--perf-check")) options.m_PerfCheck = true;
+		else if (!strcmp(arg, "--perf-baseline")) options.m_PerfCheck = options.m_PerfBaseline = true;
+		else if (!strcmp(arg, "--perf-history") && hasValue) options.m_PerfHistory = argv[++i];
+		else if (!strcmp(arg, "--perf-threshold") && hasValue && ParseFloat(argv[i + 1], options.m_PerfThreshold, 0.0f)) i++;
+		else {
+			std::cerr << "Unknown option, or missing or invalid value for \"" << arg << "\".\n";
+			PrintUsage(argv[0]);
+
+			return false;
+		}
+	}
+
+	if (options.m_SceneSize > MaxSceneSize(options.m_Scene))
+	{
+		std::cerr << "--scene-size " << options.m_SceneSize << " is too large for the " << SceneKindName(options.m_Scene)
+		          << " scene (at most " << MaxSceneSize(options.m_Scene) << ").\n";
+		PrintUsage(argv[0]);
+
+		return false;
+	}
+
+	if (options.m_Resume && !options.m_Checkpoint)
+	{
+		std::cerr << "--resume needs --checkpoint.\n";
+		return false;
+	}
+
+	if (options.m_Merge && !options.m_Crop && !options.m_Mask)
+	{
+		std::cerr << "--merge needs --crop or --mask.\n";
+		return false;
+	}
+
+	return CheckCombinations(options);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+const size_t CacheLineSize = 64;
+
+// Thread helpers that also work when OpenMP is disabled. {{{
+inline int ThreadCount()
+{
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+inline int ThreadIndex()
+{
+#ifdef _OPENMP
+	return omp_get_thread_num();
+#else
+	return 0;
+#endif
+}
+
+inline void SetThreadCount(int count)
+{
+#ifdef _OPENMP
+	if (count > 0) omp_set_num_threads(count);
+#else
+	(void)count;
+#endif
+}
+// }}}
+
+// Allocator returning cache line aligned storage, so that std::vector can hold
+// over-aligned types (C++14 "new" ignores alignas) and buffers whose rows must
+// start on a line boundary.
+//
+template <typename T> struct AlignedAllocator
+{
+	typedef T value_type;
+
+	AlignedAllocator() {}
+	template <typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+
+	T* allocate(size_t count)
+	{
+		// Over-allocate and keep the original pointer right before the aligned block.
+		void* raw = std::malloc(count * sizeof(T) + CacheLineSize + sizeof(void*));
+
+		if (!raw) throw std::bad_alloc();
+
+		uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + CacheLineSize - 1) & ~(uintptr_t)(CacheLineSize - 1);
+		reinterpret_cast<void**>(aligned)[-1] = raw;
+
+		return reinterpret_cast<T*>(aligned);
+	}
+
+	void deallocate(T* ptr, size_t)
+	{
+		if (ptr) std::free(reinterpret_cast<void**>(ptr)[-1]);
+	}
+};
+
+template <typename T, typename U> bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return true; }
+template <typename T, typename U> bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return false; }
+
+template <typename T> using AlignedVector = std::vector<T, AlignedAllocator<T>>;
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__linux__)
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+// Hardware events counted by PerfCounters.
+enum PerfEvent
+{
+	PerfCycles,
+	PerfInstructions,
+	PerfL1dMisses,    // L1 data cache read misses.
+	PerfLlcMisses,    // Last level cache misses.
+	PerfBranchMisses,
+	PerfEventCount,
+};
+
+inline const char* PerfEventName(int event)
+{
+	const char* names[] = { "cycles", "instructions", "L1d misses", "LLC misses", "branch misses" };
+
+	return names[event];
+}
+
+// Counter values over one or more intervals; events the processor or kernel
+// would not count are flagged unavailable and stay zero.
+//
+struct PerfSample
+{
+	uint64_t m_Values[PerfEventCount];
+	bool m_Available[PerfEventCount];
+
+	PerfSample()
+	{
+		for (int e = 0; e < PerfEventCount; e++) {
+			m_Values[e] = 0;
+			m_Available[e] = false;
+		}
+	}
+
+	bool Has(int event) const { return m_Available[event]; }
+
+	// Ratio of two events, or 0 when one is missing.
+	double Ratio(int numerator, int denominator) const
+	{
+		return Has(numerator) && Has(denominator) && m_Values[denominator] ? double(m_Values[numerator]) / m_Values[denominator] : 0.0;
+	}
+
+	PerfSample& operator+=(const PerfSample& other)
+	{
+		for (int e = 0; e < PerfEventCount; e++) {
+			m_Values[e] += other.m_Values[e];
+			m_Available[e] = m_Available[e] || other.m_Available[e];
+		}
+
+		return *this;
+	}
+};
+
+// Hardware counters of the calling thread, read as one perf_event group so
+// all cover the same interval. Open and read them on the thread to measure.
+// Only Linux has them; on other systems, or when the kernel refuses
+// (perf_event_paranoid, virtual machines without a PMU), Available() is false.
+//
+struct PerfCounters
+{
+	int m_Fds[PerfEventCount];
+	int m_Leader;
+	PerfSample m_Sample;
+
+	PerfCounters() : m_Leader(-1)
+	{
+		for (int e = 0; e < PerfEventCount; e++) m_Fds[e] = -1;
+
+#if defined(__linux__)
+		const uint64_t l1dRead = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+		const uint32_t types[] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE };
+		const uint64_t configs[] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, l1dRead, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+		// Events that fail to open are left out of the group.
+		for (int e = 0; e < PerfEventCount; e++) {
+			m_Fds[e] = Open(types[e], configs[e], m_Leader);
+
+			if (m_Leader < 0) m_Leader = m_Fds[e];
+		}
+#endif
+	}
+
+	~PerfCounters()
+	{
+#if defined(__linux__)
+		for (int e = PerfEventCount - 1; e >= 0; e--) {
+			if (m_Fds[e] >= 0) close(m_Fds[e]);
+		}
+#endif
+	}
+
+	bool Available() const { return m_Fds[PerfCycles] >= 0 && m_Fds[PerfInstructions] >= 0; }
+
+	void Start()
+	{
+#if defined(__linux__)
+		if (m_Leader < 0) return;
+
+		ioctl(m_Leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(m_Leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+	}
+
+	void Stop()
+	{
+#if defined(__linux__)
+		if (m_Leader < 0) return;
+
+		ioctl(m_Leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+		// Event count, then the values in the order the events joined the group.
+		uint64_t values[1 + PerfEventCount] = {};
+
+		if (read(m_Leader, values, sizeof(values)) <= 0) return;
+
+		for (int e = 0, k = 1; e < PerfEventCount; e++) {
+			m_Sample.m_Available[e] = m_Fds[e] >= 0;
+			m_Sample.m_Values[e] = m_Fds[e] >= 0 ? values[k++] : 0;
+		}
+#endif
+	}
+
+	double InstructionsPerCycle() const { return m_Sample.Ratio(PerfInstructions, PerfCycles); }
+
+#if defined(__linux__)
+	static int Open(uint32_t type, uint64_t config, int group)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = group < 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+
+		return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+	}
+#endif
+
+private:
+	PerfCounters(const PerfCounters&);
+	PerfCounters& operator=(const PerfCounters&);
+};
+
+// Runs "stage" and, when enabled, adds what the calling thread counted meanwhile to "sample".
+template <typename Stage> void CountEvents(bool enabled, PerfSample& sample, Stage stage)
+{
+	if (!enabled)
+	{
+		stage();
+		return;
+	}
+
+	PerfCounters counters;
+
+	counters.Start();
+	stage();
+	counters.Stop();
+
+	sample += counters.m_Sample;
+}
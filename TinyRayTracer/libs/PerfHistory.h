@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+// Benchmark results kept across builds, one line per metric and run:
+//
+//   <metric> <baseline|run> <sample> <sample> ...
+//
+// Higher samples are better for every metric. The latest baseline line of a
+// metric is what new runs are compared against.
+//
+struct PerfRecord
+{
+	std::string m_Metric;
+	bool m_Baseline;
+	std::vector<double> m_Samples;
+};
+
+inline std::vector<PerfRecord> LoadPerfHistory(const char* path)
+{
+	std::vector<PerfRecord> records;
+	std::ifstream ifs(path);
+	std::string line;
+
+	while (std::getline(ifs, line)) {
+		std::istringstream fields(line);
+		PerfRecord record;
+		std::string kind;
+		double sample;
+
+		if (!(fields >> record.m_Metric >> kind)) continue;
+
+		record.m_Baseline = kind == "baseline";
+
+		while (fields >> sample) record.m_Samples.push_back(sample);
+
+		records.push_back(record);
+	}
+
+	return records;
+}
+
+inline bool AppendPerfHistory(const char* path, const PerfRecord& record)
+{
+	std::ofstream ofs(path, std::ofstream::out | std::ofstream::app);
+
+	ofs << record.m_Metric << (record.m_Baseline ? " baseline" : " run");
+
+	for (size_t i = 0; i < record.m_Samples.size(); i++) ofs << " " << record.m_Samples[i];
+
+	ofs << "\n";
+
+	return ofs.good();
+}
+
+// Latest baseline of "metric", or NULL.
+inline const PerfRecord* FindBaseline(const std::vector<PerfRecord>& records, const std::string& metric)
+{
+	for (size_t i = records.size(); i-- > 0;) {
+		if (records[i].m_Baseline && records[i].m_Metric == metric) return &records[i];
+	}
+
+	return NULL;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+
+// PCG32 (O'Neill, pcg-random.org): small state, good statistics, and cheap to
+// reseed per pixel so renders do not depend on the thread schedule.
+//
+struct Random
+{
+	uint64_t m_State;
+	uint64_t m_Increment;
+
+	Random(uint64_t seed = 0, uint64_t stream = 0)
+		: m_State(0), m_Increment((stream << 1u) | 1u)
+	{
+		NextUInt();
+		m_State += seed;
+		NextUInt();
+	}
+
+	uint32_t NextUInt()
+	{
+		uint64_t old = m_State;
+		m_State = old * 6364136223846793005ULL + m_Increment;
+
+		uint32_t xorShifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+		uint32_t rotation = (uint32_t)(old >> 59u);
+
+		return (xorShifted >> rotation) | (xorShifted << ((~rotation + 1u) & 31));
+	}
+
+	float NextFloat() { return (NextUInt() >> 8) * (1.0f / 16777216.0f); } // [0, 1).
+};
+
+inline uint64_t HashSeed(uint64_t a, uint64_t b, uint64_t c)
+{
+	uint64_t h = a * 0x9E3779B97F4A7C15ULL ^ (b + 0x632BE59BD9B4E019ULL) * 0xBF58476D1CE4E5B9ULL ^ (c + 1) * 0x94D049BB133111EBULL;
+
+	h ^= h >> 31;
+	h *= 0xD6E8FEB86659FD93ULL;
+	h ^= h >> 32;
+
+	return h;
+}
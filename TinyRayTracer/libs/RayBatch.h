@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "Geometry.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// Rays traced together by the batched pipeline. Eight lanes fill one AVX
+// register; the scalar fallback loops are written so compilers vectorize them.
+//
+const int BatchSize = 8;
+const int BatchFullMask = (1 << BatchSize) - 1;
+
+// Structure of arrays: one register per component.
+struct alignas(32) Vec3Batch
+{
+	float x[BatchSize];
+	float y[BatchSize];
+	float z[BatchSize];
+
+	Vec3f Get(int lane) const { return Vec3f(x[lane], y[lane], z[lane]); }
+
+	void Set(int lane, const Vec3f& v) { x[lane] = v.x; y[lane] = v.y; z[lane] = v.z; }
+};
+
+// Batched kernels. {{{
+inline void ReflectBatch(const Vec3Batch& direction, const Vec3Batch& normal, Vec3Batch& result)
+{
+	for (int i = 0; i < BatchSize; i++) {
+		float d = direction.x[i] * normal.x[i] + direction.y[i] * normal.y[i] + direction.z[i] * normal.z[i];
+
+		result.x[i] = direction.x[i] - (normal.x[i] * 2.0f) * d;
+		result.y[i] = direction.y[i] - (normal.y[i] * 2.0f) * d;
+		result.z[i] = direction.z[i] - (normal.z[i] * 2.0f) * d;
+	}
+}
+
+inline void NormalizeBatch(Vec3Batch& v)
+{
+	for (int i = 0; i < BatchSize; i++) {
+		float l = 1.0f / std::sqrt(v.x[i] * v.x[i] + v.y[i] * v.y[i] + v.z[i] * v.z[i]);
+
+		v.x[i] *= l;
+		v.y[i] *= l;
+		v.z[i] *= l;
+	}
+}
+
+// Snell's law without branches: rays leaving the surface ("c < 0") select the
+// inverted ratio and flipped normal per lane. Returns the lanes that undergo
+// total internal reflection; their result is left finite but meaningless.
+//
+inline int RefractBatch(const Vec3Batch& direction, const Vec3Batch& normal, const float* refractiveIndex, Vec3Batch& result)
+{
+#if defined(__AVX__)
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 signBit = _mm256_set1_ps(-0.0f);
+
+	__m256 dx = _mm256_load_ps(direction.x), dy = _mm256_load_ps(direction.y), dz = _mm256_load_ps(direction.z);
+	__m256 nx = _mm256_load_ps(normal.x), ny = _mm256_load_ps(normal.y), nz = _mm256_load_ps(normal.z);
+	__m256 ior = _mm256_loadu_ps(refractiveIndex);
+
+	__m256 c = _mm256_sub_ps(zero, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, dx), _mm256_mul_ps(ny, dy)), _mm256_mul_ps(nz, dz)));
+	__m256 inside = _mm256_cmp_ps(c, zero, _CMP_LT_OQ);
+
+	__m256 r = _mm256_blendv_ps(_mm256_div_ps(one, ior), ior, inside);
+	__m256 flip = _mm256_and_ps(inside, signBit);
+
+	c = _mm256_xor_ps(c, flip);
+	nx = _mm256_xor_ps(nx, flip);
+	ny = _mm256_xor_ps(ny, flip);
+	nz = _mm256_xor_ps(nz, flip);
+
+	__m256 k = _mm256_mul_ps(_mm256_mul_ps(r, r), _mm256_sub_ps(one, _mm256_mul_ps(c, c)));
+	__m256 s = _mm256_sqrt_ps(_mm256_max_ps(zero, _mm256_sub_ps(one, k)));
+	__m256 t = _mm256_sub_ps(_mm256_mul_ps(r, c), s);
+
+	_mm256_store_ps(result.x, _mm256_add_ps(_mm256_mul_ps(dx, r), _mm256_mul_ps(nx, t)));
+	_mm256_store_ps(result.y, _mm256_add_ps(_mm256_mul_ps(dy, r), _mm256_mul_ps(ny, t)));
+	_mm256_store_ps(result.z, _mm256_add_ps(_mm256_mul_ps(dz, r), _mm256_mul_ps(nz, t)));
+
+	return _mm256_movemask_ps(_mm256_cmp_ps(k, one, _CMP_GT_OQ));
+#else
+	int totalInternalReflection = 0;
+
+	for (int i = 0; i < BatchSize; i++) {
+		float c = - (normal.x[i] * direction.x[i] + normal.y[i] * direction.y[i] + normal.z[i] * direction.z[i]);
+		float sign = c < 0 ? -1.0f : 1.0f;
+		float r = c < 0 ? refractiveIndex[i] : 1.0f / refractiveIndex[i];
+
+		c *= sign;
+
+		float k = (r * r) * (1 - (c * c));
+		float s = std::sqrt(std::max(0.0f, 1.0f - k));
+		float t = (r * c) - s;
+
+		result.x[i] = (direction.x[i] * r) + (normal.x[i] * sign * t);
+		result.y[i] = (direction.y[i] * r) + (normal.y[i] * sign * t);
+		result.z[i] = (direction.z[i] * r) + (normal.z[i] * sign * t);
+
+		totalInternalReflection |= (k > 1.0f) << i;
+	}
+
+	return totalInternalReflection;
+#endif
+}
+// }}}
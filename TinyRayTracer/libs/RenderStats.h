@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Parallel.h"
+#include "PerfCounters.h"
+#include "Random.h"
+#include "Sampling.h"
+
+struct CostMap;
+struct RenderRegion;
+struct ImportanceMap;
+struct GuideBuffer;
+struct PixelGuide;
+
+struct RenderStats
+{
+	uint64_t m_PrimaryRays;
+	uint64_t m_SecondaryRays;
+	uint64_t m_ShadowRays;
+	uint64_t m_IntersectionTests;
+
+	RenderStats()
+		: m_PrimaryRays(0), m_SecondaryRays(0), m_ShadowRays(0), m_IntersectionTests(0) {}
+
+	uint64_t TotalRays() const { return m_PrimaryRays + m_SecondaryRays + m_ShadowRays; }
+
+	RenderStats& operator+=(const RenderStats& other)
+	{
+		m_PrimaryRays += other.m_PrimaryRays;
+		m_SecondaryRays += other.m_SecondaryRays;
+		m_ShadowRays += other.m_ShadowRays;
+		m_IntersectionTests += other.m_IntersectionTests;
+
+		return *this;
+	}
+};
+
+// Everything a render thread writes while tracing lives here. Each context is
+// aligned and padded to a cache line, so two threads never share one.
+// The random generator is reseeded for every pixel sample.
+//
+struct alignas(CacheLineSize) ThreadContext
+{
+	RenderStats m_Stats;
+	Random m_Random;
+
+	int m_LightSamples;         // Samples per area light and strategy.
+	MisHeuristic m_Heuristic;
+	bool m_RefineHits;          // Mixed precision: traverse in float, re-solve the closest hit in double.
+	CostMap* m_Costs;           // Per-pixel costs are recorded when set.
+	PerfSample m_Events;        // Hardware counters over the thread's tiles, with --perf-counters.
+	const RenderRegion* m_Region; // Only its pixels are traced when set.
+	int m_FirstSample;          // Samples [first, last) of each pixel are traced. Unless the
+	int m_LastSample;           // last one is among them, pixels hold unnormalized sums.
+	int m_MaxDepth;             // Rays deeper than this return the background.
+	const ImportanceMap* m_Importance; // Per-pixel samples, light samples and depth when set.
+	GuideBuffer* m_Guides;      // Primary hits are recorded here when set,
+	PixelGuide* m_Guide;        // for the pixel being traced.
+
+	ThreadContext()
+		: m_Stats(), m_Random(), m_LightSamples(1), m_Heuristic(MisPower), m_RefineHits(false), m_Costs(NULL), m_Events(), m_Region(NULL), m_FirstSample(0), m_LastSample(1), m_MaxDepth(5), m_Importance(NULL), m_Guides(NULL), m_Guide(NULL) {}
+};
+
+static_assert(sizeof(ThreadContext) % CacheLineSize == 0, "ThreadContext must be padded to a whole cache line.");
+
+typedef AlignedVector<ThreadContext> ThreadContexts;
+
+inline RenderStats MergeStats(const ThreadContexts& contexts)
+{
+	RenderStats total;
+
+	for (size_t i = 0; i < contexts.size(); i++) total += contexts[i].m_Stats;
+
+	return total;
+}
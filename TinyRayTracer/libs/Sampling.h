@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include "Geometry.h"
+#include "Random.h"
+
+const float Pi = 3.14159265358979323846f;
+
+// How light samples and glossy lobe samples are combined (multiple importance sampling).
+enum MisHeuristic
+{
+	MisPower,     // Veach's power heuristic, beta = 2.
+	MisBalance,
+	MisLightOnly, // No lobe samples: plain light sampling.
+	MisLobeOnly,  // Specular from lobe samples only.
+};
+
+// Tangent frame around "n" (Duff et al., "Building an Orthonormal Basis, Revisited").
+inline void OrthonormalBasis(const Vec3f& n, Vec3f& tangent, Vec3f& bitangent)
+{
+	float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+	float a = -1.0f / (sign + n.z);
+	float b = n.x * n.y * a;
+
+	tangent = Vec3f(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+	bitangent = Vec3f(b, sign + n.y * n.y * a, -n.y);
+}
+
+inline Vec3f FromLocal(const Vec3f& axis, float cosTheta, float phi)
+{
+	Vec3f tangent, bitangent;
+	OrthonormalBasis(axis, tangent, bitangent);
+
+	float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+
+	return tangent * (sinTheta * std::cos(phi)) + bitangent * (sinTheta * std::sin(phi)) + axis * cosTheta;
+}
+
+// Uniform direction inside the cone around "axis"; pdf = 1 / ConeSolidAngle.
+inline Vec3f SampleCone(const Vec3f& axis, float cosThetaMax, float u1, float u2)
+{
+	return FromLocal(axis, 1.0f - u1 * (1.0f - cosThetaMax), 2.0f * Pi * u2);
+}
+
+inline float ConeSolidAngle(float cosThetaMax)
+{
+	return 2.0f * Pi * (1.0f - cosThetaMax);
+}
+
+// Direction distributed like the Phong lobe cos^n around "axis".
+inline Vec3f SamplePhongLobe(const Vec3f& axis, float exponent, float u1, float u2)
+{
+	return FromLocal(axis, std::pow(u1, 1.0f / (exponent + 1.0f)), 2.0f * Pi * u2);
+}
+
+inline float PhongLobePdf(float cosAlpha, float exponent)
+{
+	return cosAlpha > 0.0f ? (exponent + 1.0f) / (2.0f * Pi) * std::pow(cosAlpha, exponent) : 0.0f;
+}
+
+// Weight of a sample drawn with "pdf" when the other strategy would have drawn it with "otherPdf".
+inline float MisWeight(float pdf, float otherPdf, MisHeuristic heuristic)
+{
+	if (heuristic == MisBalance) return pdf / (pdf + otherPdf);
+
+	return (pdf * pdf) / (pdf * pdf + otherPdf * otherPdf);
+}
+
+// Direction distributed like cos(theta) around "axis"; pdf = cos(theta) / pi.
+inline Vec3f SampleCosineHemisphere(const Vec3f& axis, float u1, float u2)
+{
+	return FromLocal(axis, std::sqrt(1.0f - u1), 2.0f * Pi * u2);
+}
+
+// Uniform direction over the whole sphere; pdf = 1 / (4 pi).
+inline Vec3f SampleSphere(float u1, float u2)
+{
+	return FromLocal(Vec3f(0.0f, 0.0f, 1.0f), 1.0f - 2.0f * u1, 2.0f * Pi * u2);
+}
+
+// Sample "sample" of "count" on a jittered sqrt(count) x sqrt(count) grid of
+// the unit square, from the jitter (j1, j2); samples beyond the largest
+// square that fits are left unstratified.
+//
+inline void StratifiedSample(int sample, int count, float j1, float j2, float& u1, float& u2)
+{
+	int side = (int)std::sqrt((float)count);
+
+	if (sample >= side * side)
+	{
+		u1 = j1;
+		u2 = j2;
+		return;
+	}
+
+	u1 = (sample % side + j1) / side;
+	u2 = (sample / side + j2) / side;
+}
+
+// Sets of cosine-distributed directions around +z, each on its own jittered
+// grid, drawn once and reused for many points: Direction() turns a set by an
+// angle about z and takes it into the frame of a normal, which costs no
+// trigonometry per ray. Points picking different sets and angles avoid the
+// pattern a single shared set would leave.
+//
+struct CosineTable
+{
+	std::vector<Vec3f> m_Directions; // Set after set.
+	int m_Count;                     // Directions per set.
+
+	CosineTable() : m_Count(0) {}
+
+	void Build(int count, int sets, Random& random)
+	{
+		m_Count = count;
+		m_Directions.resize(size_t(count) * sets);
+
+		for (size_t k = 0; k < m_Directions.size(); k++) {
+			float u1, u2;
+			StratifiedSample(int(k % count), count, random.NextFloat(), random.NextFloat(), u1, u2);
+
+			float cosTheta = std::sqrt(1.0f - u1), sinTheta = std::sqrt(u1), phi = 2.0f * Pi * u2;
+
+			m_Directions[k] = Vec3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+		}
+	}
+
+	int Sets() const { return m_Count ? int(m_Directions.size() / m_Count) : 0; }
+
+	// Direction "k" of "set" turned by the angle of (cosine, sine) about the
+	// normal, with "tangent", "bitangent" and "normal" from OrthonormalBasis.
+	Vec3f Direction(int set, int k, float cosine, float sine, const Vec3f& tangent, const Vec3f& bitangent, const Vec3f& normal) const
+	{
+		const Vec3f& d = m_Directions[size_t(set) * m_Count + k];
+
+		return tangent * (d.x * cosine - d.y * sine) + bitangent * (d.x * sine + d.y * cosine) + normal * d.z;
+	}
+};
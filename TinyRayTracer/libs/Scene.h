@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include "Geometry.h"
+#include "Sphere.h"
+#include "Light.h"
+#include "IntersectKernels.h"
+
+// The checkerboard: a 20x20 square of the plane "y = -4", between z = -10 and
+// z = -30, moved by m_Offset together with the rest of the world.
+//
+template <typename T> struct CheckerboardT
+{
+	vec<3, T> m_Offset;
+	bool m_Enabled;
+
+	CheckerboardT() : m_Offset(), m_Enabled(true) {}
+
+	template <typename U> explicit CheckerboardT(const CheckerboardT<U>& other)
+		: m_Offset(other.m_Offset), m_Enabled(other.m_Enabled) {}
+
+	bool RayIntersect(const vec<3, T>& origin, const vec<3, T>& direction, T& t) const
+	{
+		if (!m_Enabled || std::fabs(direction.y) <= 1e-3) return false;
+
+		T d = - (origin.y - (m_Offset.y - T(4))) / direction.y;
+		vec<3, T> p = origin + direction * d;
+
+		T x = p.x - m_Offset.x, z = p.z - m_Offset.z;
+
+		if (d > 0 && std::fabs(x) < 10 && z < -10 && z > -30) { t = d; return true; }
+
+		return false;
+	}
+
+	Vec3f Color(const vec<3, T>& p) const
+	{
+		T x = p.x - m_Offset.x, z = p.z - m_Offset.z;
+
+		return (int(T(0.5) * x + 1000) + int(T(0.5) * z)) & 1 ? Vec3f(1.0f, 1.0f, 1.0f) : Vec3f(1.0f, 0.7f, 0.3f);
+	}
+};
+
+// Everything Render needs: geometry in precision T, lights and the eye position.
+template <typename T> struct SceneT
+{
+	std::vector<SphereT<T> > m_Spheres;
+	std::vector<Light> m_Lights;
+	CheckerboardT<T> m_Checkerboard;
+	vec<3, T> m_Eye;
+
+	// --world-offset. The scene is built at the origin and moved by Placed()
+	// once it has the precision under test, so that a double copy keeps the
+	// coordinates the float one rounds.
+	Vec3d m_WorldOffset;
+
+	// Mixed precision traversal copy, from BuildRelative(): the geometry in
+	// float, relative to the eye, where its coordinates stay small, with the
+	// spheres as arrays for the SIMD kernels.
+	SphereSoA m_RelativeSpheres;
+	CheckerboardT<float> m_RelativeCheckerboard;
+
+	SceneT() : m_Eye(), m_WorldOffset() {}
+
+	template <typename U> explicit SceneT(const SceneT<U>& other)
+		: m_Lights(other.m_Lights), m_Checkerboard(other.m_Checkerboard), m_Eye(other.m_Eye), m_WorldOffset(other.m_WorldOffset)
+	{
+		for (size_t i = 0; i < other.m_Spheres.size(); i++) m_Spheres.push_back(SphereT<T>(other.m_Spheres[i]));
+	}
+
+	void BuildRelative()
+	{
+		std::vector<Sphere> spheres;
+
+		for (size_t i = 0; i < m_Spheres.size(); i++) {
+			spheres.push_back(Sphere(m_Spheres[i]));
+			spheres.back().m_Center = Vec3f(m_Spheres[i].m_Center - m_Eye);
+		}
+
+		m_RelativeSpheres = SphereSoA(spheres);
+		m_RelativeCheckerboard = CheckerboardT<float>(m_Checkerboard);
+		m_RelativeCheckerboard.m_Offset = Vec3f(m_Checkerboard.m_Offset - m_Eye);
+	}
+
+	bool Offset() const { return m_WorldOffset.x != 0.0 || m_WorldOffset.y != 0.0 || m_WorldOffset.z != 0.0; }
+
+	// A copy moved by the world offset, in precision T.
+	SceneT Placed() const
+	{
+		SceneT placed(*this);
+
+		placed.Translate(vec<3, T>(m_WorldOffset));
+		placed.m_WorldOffset = Vec3d();
+
+		return placed;
+	}
+
+	// Moves the whole world, eye included; the image does not change, only the magnitude of the coordinates.
+	void Translate(const vec<3, T>& offset)
+	{
+		for (size_t i = 0; i < m_Spheres.size(); i++) m_Spheres[i].m_Center = m_Spheres[i].m_Center + offset;
+		for (size_t i = 0; i < m_Lights.size(); i++) m_Lights[i].m_Position = m_Lights[i].m_Position + Vec3f(offset);
+
+		m_Checkerboard.m_Offset = m_Checkerboard.m_Offset + offset;
+		m_Eye = m_Eye + offset;
+	}
+};
+
+typedef CheckerboardT<float> Checkerboard;
+typedef SceneT<float> Scene;
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "Geometry.h"
+#include "Sphere.h"
+#include "Light.h"
+#include "Random.h"
+#include "Sampling.h"
+#include "Scene.h"
+
+// Stress scenes for benchmarking. Every sphere (and light) draws from its own
+// generator, seeded from the scene seed and its index, so generation runs in
+// parallel and the scene does not depend on the number of threads.
+//
+enum SceneKind
+{
+	DefaultScene,
+	SphereflakeScene,  // Size: recursion depth.
+	RandomFieldScene,  // Size: sphere count, uniform in a box.
+	ClusteredScene,    // Size: sphere count, in clusters of about 64.
+	MirrorGlassScene,  // Size: spheres per side of a grid of mirrors and glass.
+	ManyLightsScene,   // Size: light count, around the default spheres.
+};
+
+inline bool ParseSceneKind(const char* name, SceneKind& kind)
+{
+	if (!strcmp(name, "default")) kind = DefaultScene;
+	else if (!strcmp(name, "flake")) kind = SphereflakeScene;
+	else if (!strcmp(name, "random")) kind = RandomFieldScene;
+	else if (!strcmp(name, "clustered")) kind = ClusteredScene;
+	else if (!strcmp(name, "grid")) kind = MirrorGlassScene;
+	else if (!strcmp(name, "lights")) kind = ManyLightsScene;
+	else return false;
+
+	return true;
+}
+
+inline const char* SceneKindName(SceneKind kind)
+{
+	const char* names[] = { "default", "flake", "random", "clustered", "grid", "lights" };
+
+	return names[kind];
+}
+
+// Size used when none is given.
+inline int DefaultSceneSize(SceneKind kind)
+{
+	switch (kind)
+	{
+	case SphereflakeScene: return 3;
+	case RandomFieldScene: return 256;
+	case ClusteredScene: return 256;
+	case MirrorGlassScene: return 8;
+	case ManyLightsScene: return 64;
+	default: return 0;
+	}
+}
+
+// Largest size accepted: beyond it the scene does not fit in memory, or its
+// sphere count in an int. A flake of depth 8 already has 48 million spheres.
+inline int MaxSceneSize(SceneKind kind)
+{
+	switch (kind)
+	{
+	case SphereflakeScene: return 8;
+	case RandomFieldScene: return 1 << 24;
+	case ClusteredScene: return 1 << 24;
+	case MirrorGlassScene: return 46340;
+	case ManyLightsScene: return 1 << 16;
+	default: return INT_MAX; // The size is not used.
+	}
+}
+
+struct MaterialPalette
+{
+	Material m_Ivory;
+	Material m_Glass;
+	Material m_RedRubber;
+	Material m_Mirror;
+
+	explicit MaterialPalette(bool microfacet)
+		: m_Ivory(1.0, Vec4f(0.6,  0.3, 0.1, 0.0), Vec3f(0.4, 0.4, 0.3),   50.0),
+		  m_Glass(1.5, Vec4f(0.0,  0.5, 0.1, 0.8), Vec3f(0.6, 0.7, 0.8),  125.0),
+		  m_RedRubber(1.0, Vec4f(0.9,  0.1, 0.0, 0.0), Vec3f(0.3, 0.1, 0.1),   10.0),
+		  m_Mirror(1.0, Vec4f(0.0, 10.0, 0.8, 0.0), Vec3f(1.0, 1.0, 1.0), 1425.0)
+	{
+		if (microfacet)
+		{
+			m_Ivory     = Material(DielectricModel, 1.5, Vec3f(0.4,  0.4,  0.3),  0.5);
+			m_Glass     = Material(DielectricModel, 1.5, Vec3f(0.6,  0.7,  0.8),  0.1, 1.0);
+			m_RedRubber = Material(DielectricModel, 1.5, Vec3f(0.3,  0.1,  0.1),  0.8);
+			m_Mirror    = Material(ConductorModel,  1.0, Vec3f(0.95, 0.93, 0.88), 0.15);
+		}
+	}
+
+	const Material& operator[](int i) const
+	{
+		const Material* materials[] = { &m_Ivory, &m_Glass, &m_RedRubber, &m_Mirror };
+
+		return *materials[i & 3];
+	}
+};
+
+inline void AddDefaultSpheres(Scene& scene, const MaterialPalette& palette)
+{
+	scene.m_Spheres.push_back(Sphere(Vec3f(-3.0,  0.0, -16.0), 2, palette.m_Ivory));
+	scene.m_Spheres.push_back(Sphere(Vec3f(-1.0, -1.5, -12.0), 2, palette.m_Glass));
+	scene.m_Spheres.push_back(Sphere(Vec3f( 1.5, -0.5, -18.0), 3, palette.m_RedRubber));
+	scene.m_Spheres.push_back(Sphere(Vec3f( 7.0,  5.0, -18.0), 4, palette.m_Mirror));
+}
+
+inline void AddDefaultLights(Scene& scene)
+{
+	scene.m_Lights.push_back(Light(Vec3f(-20.0, 20.0,  20.0), 1.5));
+	scene.m_Lights.push_back(Light(Vec3f( 30.0, 50.0, -25.0), 1.8));
+	scene.m_Lights.push_back(Light(Vec3f( 30.0, 20.0,  30.0), 1.7));
+}
+
+// Sphereflake (Haines, "A Proposal for Standard Graphics Environments"):
+// every sphere carries 9 children a third of its size, 6 around its equator
+// and 3 above, all facing away from the parent.
+//
+inline size_t SphereflakeCount(int depth)
+{
+	return depth <= 0 ? 1 : 1 + 9 * SphereflakeCount(depth - 1);
+}
+
+inline Vec3f SphereflakeChildAxis(const Vec3f& axis, int child)
+{
+	if (child < 6) return FromLocal(axis, 0.0f, child * Pi / 3.0f);
+
+	return FromLocal(axis, 0.5f, (child - 6) * 2.0f * Pi / 3.0f + Pi / 6.0f); // 60 degrees up.
+}
+
+// Writes the subtree of one sphere depth first from "index", which is how the
+// parallel caller knows where each child subtree starts.
+//
+inline void AddSphereflake(std::vector<Sphere>& spheres, size_t index, const Vec3f& center, float radius, const Vec3f& axis,
+                           int depth, int level, const MaterialPalette& palette)
+{
+	spheres[index] = Sphere(center, radius, level & 1 ? palette.m_Ivory : palette.m_Mirror);
+
+	if (depth == 0) return;
+
+	const size_t childCount = SphereflakeCount(depth - 1);
+
+	for (int k = 0; k < 9; k++) {
+		Vec3f childAxis = SphereflakeChildAxis(axis, k);
+
+		AddSphereflake(spheres, index + 1 + k * childCount, center + childAxis * (radius * 4.0f / 3.0f), radius / 3.0f, childAxis, depth - 1, level + 1, palette);
+	}
+}
+
+inline void GenerateSphereflake(Scene& scene, int depth, const MaterialPalette& palette)
+{
+	const Vec3f center(0.0f, -0.5f, -20.0f), axis(0.0f, 1.0f, 0.0f);
+	const float radius = 3.0f;
+
+	std::vector<Sphere>& spheres = scene.m_Spheres;
+	spheres.assign(SphereflakeCount(depth), Sphere(Vec3f(), 0.0f, Material()));
+	spheres[0] = Sphere(center, radius, palette.m_Mirror);
+
+	if (depth == 0) return;
+
+	const size_t childCount = SphereflakeCount(depth - 1);
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int k = 0; k < 9; k++) {
+		Vec3f childAxis = SphereflakeChildAxis(axis, k);
+
+		AddSphereflake(spheres, 1 + k * childCount, center + childAxis * (radius * 4.0f / 3.0f), radius / 3.0f, childAxis, depth - 1, 1, palette);
+	}
+}
+
+// Spheres in the box in front of the camera, above the checkerboard. Their
+// size shrinks with the count so the box stays about equally full.
+//
+inline void GenerateRandomField(Scene& scene, int count, bool clustered, unsigned seed, const MaterialPalette& palette)
+{
+	const Vec3f boxMin(-10.0f, -4.0f, -40.0f), boxMax(10.0f, 8.0f, -12.0f);
+	const float radius = std::min(2.0f, 6.0f / std::cbrt(float(std::max(1, count))));
+	const int clusters = std::max(1, count / 64);
+
+	std::vector<Sphere>& spheres = scene.m_Spheres;
+	spheres.assign(std::max(0, count), Sphere(Vec3f(), 0.0f, Material()));
+
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < count; i++) {
+		Random random(HashSeed(seed, i, clustered));
+		Vec3f center;
+
+		if (clustered)
+		{
+			// Cluster centers come from their own generators; members spread
+			// around them with a roughly normal (sum of uniforms) offset.
+			Random clusterRandom(HashSeed(seed, i % clusters, 2));
+
+			for (size_t c = 0; c < 3; c++) {
+				float middle = boxMin[c] + (boxMax[c] - boxMin[c]) * clusterRandom.NextFloat();
+				float offset = random.NextFloat() + random.NextFloat() + random.NextFloat() - 1.5f;
+
+				center[c] = std::min(boxMax[c], std::max(boxMin[c], middle + offset * radius * 3.0f));
+			}
+		}
+		else
+		{
+			for (size_t c = 0; c < 3; c++) center[c] = boxMin[c] + (boxMax[c] - boxMin[c]) * random.NextFloat();
+		}
+
+		float size = radius * (0.5f + 0.5f * random.NextFloat());
+
+		spheres[i] = Sphere(center, size, palette[(int)(random.NextUInt() & 3)]);
+	}
+}
+
+// Alternating mirror and glass spheres over the checkerboard: nearly every
+// ray reflects and refracts down to the recursion limit of CastRay.
+//
+inline void GenerateMirrorGlassGrid(Scene& scene, int side, const MaterialPalette& palette)
+{
+	side = std::max(1, side);
+
+	const float spacing = 18.0f / side;
+
+	std::vector<Sphere>& spheres = scene.m_Spheres;
+	spheres.assign(size_t(side) * side, Sphere(Vec3f(), 0.0f, Material()));
+
+	#pragma omp parallel for schedule(static)
+	for (int z = 0; z < side; z++) {
+		for (int x = 0; x < side; x++) {
+			Vec3f center(-9.0f + (x + 0.5f) * spacing, -4.0f + spacing * 0.4f, -11.0f - (z + 0.5f) * spacing);
+
+			spheres[x + size_t(z) * side] = Sphere(center, spacing * 0.4f, (x + z) & 1 ? palette.m_Glass : palette.m_Mirror);
+		}
+	}
+}
+
+// The default spheres under "count" point lights spread over a dome. The
+// total intensity of the default lights is shared among them.
+//
+inline void GenerateManyLights(Scene& scene, int count, unsigned seed, const MaterialPalette& palette)
+{
+	AddDefaultSpheres(scene, palette);
+
+	count = std::max(1, count);
+	scene.m_Lights.assign(count, Light(Vec3f(), 0.0f));
+
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < count; i++) {
+		Random random(HashSeed(seed, i, 3));
+		Vec3f direction = FromLocal(Vec3f(0.0f, 1.0f, 0.0f), 0.2f + 0.8f * random.NextFloat(), 2.0f * Pi * random.NextFloat());
+
+		scene.m_Lights[i] = Light(Vec3f(0.0f, 0.0f, -18.0f) + direction * (30.0f + 20.0f * random.NextFloat()), 5.0f / count);
+	}
+}
+
+inline Scene GenerateScene(SceneKind kind, int size, unsigned seed, const MaterialPalette& palette)
+{
+	Scene scene;
+
+	if (size <= 0) size = DefaultSceneSize(kind);
+
+	switch (kind)
+	{
+	case SphereflakeScene: GenerateSphereflake(scene, size, palette); break;
+	case RandomFieldScene: GenerateRandomField(scene, size, false, seed, palette); break;
+	case ClusteredScene: GenerateRandomField(scene, size, true, seed, palette); break;
+	case MirrorGlassScene: GenerateMirrorGlassGrid(scene, size, palette); break;
+	case ManyLightsScene: GenerateManyLights(scene, size, seed, palette); break;
+	default: AddDefaultSpheres(scene, palette); break;
+	}
+
+	if (scene.m_Lights.empty()) AddDefaultLights(scene);
+
+	return scene;
+}
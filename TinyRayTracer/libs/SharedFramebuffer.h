@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "Geometry.h"
+#include "Parallel.h"
+#include "Framebuffer.h"
+
+// Layout of the shared memory segment, for the processes that map it:
+//
+//   SharedFrameHeader        one cache line,
+//   uint32_t ready[tiles]    per tile of TileSize pixels, row by row: the
+//                            frame that last completed the tile,
+//   float pixels[]           at m_PixelOffset, RGB per pixel, rows of
+//                            m_Stride pixels (padded past m_Width).
+//
+// Frames are numbered from 1. A reader waits for ready[tile] >= n to read
+// tile "tile" of frame n, and for m_Frame >= n to read all of it. Frame n + 1
+// is rendered into the same pixels, so a tile may change once the next frame
+// has started (m_Rendering > n); copy it first if that matters.
+//
+// Counters are 32-bit atomics, written with release and meant to be read with
+// acquire ordering. The magic string is written last, once the rest is valid.
+//
+const char SharedFrameMagic[8] = { 'T', 'R', 'T', 'F', 'R', 'M', '1', 0 };
+
+enum SharedPixelFormat
+{
+	SharedRgbFloat = 1, // Three 32-bit floats per pixel, 1.0 is full intensity.
+};
+
+struct alignas(CacheLineSize) SharedFrameHeader
+{
+	char m_Magic[8];
+	uint32_t m_HeaderSize;   // sizeof(SharedFrameHeader).
+	uint32_t m_Format;       // SharedPixelFormat.
+	uint32_t m_Width;
+	uint32_t m_Height;
+	uint32_t m_Stride;       // Pixels per row.
+	uint32_t m_TileSize;
+	uint32_t m_TilesX;
+	uint32_t m_TilesY;
+	uint32_t m_PixelOffset;  // Bytes from the start of the segment.
+	std::atomic<uint32_t> m_Rendering; // Frame being rendered, or the last one.
+	std::atomic<uint32_t> m_Frame;     // Last complete frame; 0 before the first.
+};
+
+static_assert(sizeof(SharedFrameHeader) == CacheLineSize, "SharedFrameHeader must stay one cache line.");
+
+// A framebuffer in a POSIX shared memory object ("/name", see shm_open), which
+// Render writes straight into. Other systems have no such objects and
+// Open() fails there.
+//
+struct SharedFramebuffer
+{
+	std::string m_Name;
+	void* m_Memory;
+	size_t m_Size;
+
+	SharedFrameHeader* m_Header;
+	std::atomic<uint32_t>* m_Ready;
+
+	SharedFramebuffer() : m_Memory(NULL), m_Size(0), m_Header(NULL), m_Ready(NULL) {}
+
+	~SharedFramebuffer()
+	{
+#if defined(__unix__) || defined(__APPLE__)
+		if (m_Memory) munmap(m_Memory, m_Size);
+#endif
+	}
+
+	// Creates or resizes the segment; it stays after the process exits, for
+	// readers that come late, until shm_unlink or a reboot.
+	bool Open(const char* name, int width, int height)
+	{
+		const uint32_t tilesX = (width + TileSize - 1) / TileSize, tilesY = (height + TileSize - 1) / TileSize;
+		const size_t flags = sizeof(SharedFrameHeader) + tilesX * tilesY * sizeof(uint32_t);
+		const size_t pixelOffset = (flags + CacheLineSize - 1) / CacheLineSize * CacheLineSize;
+
+		m_Name = name;
+		m_Size = pixelOffset + Framebuffer::PixelCount(width, height) * sizeof(Vec3f);
+
+#if defined(__unix__) || defined(__APPLE__)
+		int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+
+		if (fd < 0) return false;
+
+		void* memory = ftruncate(fd, (off_t)m_Size) == 0 ? mmap(NULL, m_Size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+		close(fd);
+
+		if (memory == MAP_FAILED) return false;
+
+		m_Memory = memory;
+#else
+		return false;
+#endif
+
+		m_Header = static_cast<SharedFrameHeader*>(m_Memory);
+		m_Ready = reinterpret_cast<std::atomic<uint32_t>*>(m_Header + 1);
+
+		// Readers of an older layout see no magic while the header changes.
+		memset(m_Header->m_Magic, 0, sizeof(m_Header->m_Magic));
+		std::atomic_thread_fence(std::memory_order_release);
+
+		m_Header->m_HeaderSize = sizeof(SharedFrameHeader);
+		m_Header->m_Format = SharedRgbFloat;
+		m_Header->m_Width = width;
+		m_Header->m_Height = height;
+		m_Header->m_Stride = Framebuffer::PaddedWidth(width);
+		m_Header->m_TileSize = TileSize;
+		m_Header->m_TilesX = tilesX;
+		m_Header->m_TilesY = tilesY;
+		m_Header->m_PixelOffset = (uint32_t)pixelOffset;
+		m_Header->m_Rendering.store(0, std::memory_order_relaxed);
+		m_Header->m_Frame.store(0, std::memory_order_relaxed);
+
+		for (uint32_t t = 0; t < tilesX * tilesY; t++) m_Ready[t].store(0, std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(m_Header->m_Magic, SharedFrameMagic, sizeof(SharedFrameMagic));
+
+		return true;
+	}
+
+	// Pixels of the segment, to render into with Framebuffer(width, height, Pixels()).
+	Vec3f* Pixels() const { return reinterpret_cast<Vec3f*>(static_cast<char*>(m_Memory) + m_Header->m_PixelOffset); }
+
+	uint32_t BeginFrame()
+	{
+		uint32_t frame = m_Header->m_Frame.load(std::memory_order_relaxed) + 1;
+
+		m_Header->m_Rendering.store(frame, std::memory_order_release);
+
+		return frame;
+	}
+
+	// Called by the thread that rendered "tile", a tile of the TileSize grid.
+	void TileReady(const Tile& tile)
+	{
+		uint32_t index = tile.m_X0 / TileSize + tile.m_Y0 / TileSize * m_Header->m_TilesX;
+
+		m_Ready[index].store(m_Header->m_Rendering.load(std::memory_order_relaxed), std::memory_order_release);
+	}
+
+	void EndFrame()
+	{
+		m_Header->m_Frame.store(m_Header->m_Rendering.load(std::memory_order_relaxed), std::memory_order_release);
+	}
+
+private:
+	SharedFramebuffer(const SharedFramebuffer&);
+	SharedFramebuffer& operator=(const SharedFramebuffer&);
+};
@@ -1,44 +1,91 @@
 #pragma once
 
+#include <cstdint>
+#include <cstring>
+
 #include "Geometry.h"
 
+enum MaterialModel
+{
+	PhongModel,
+	ConductorModel,  // GGX metal, m_DiffuseColor is the reflectance at normal incidence (F0).
+	DielectricModel, // GGX coating over a diffuse base, or glass when transparent.
+};
+
 struct Material
 {
 	float m_RefractiveIndex;
-	Vec4f m_Albedo;
+	Vec4f m_Albedo; // Weights of the diffuse, specular, reflected and refracted terms.
 	Vec3f m_DiffuseColor;
 	float m_SpecularExponent;
 
+	MaterialModel m_Model;
+	float m_Roughness; // Microfacet models only.
+
 	Material()
-		: m_RefractiveIndex(), m_Albedo(1.0f, 0.0f, 0.0f, 0.0f), m_DiffuseColor(), m_SpecularExponent() {}
+		: m_RefractiveIndex(), m_Albedo(1.0f, 0.0f, 0.0f, 0.0f), m_DiffuseColor(), m_SpecularExponent(), m_Model(PhongModel), m_Roughness() {}
 
 	Material(const float& refractiveIndex, const Vec4f& albedo, const Vec3f& diffuseColor, const float& specularExponent)
-		: m_RefractiveIndex(refractiveIndex), m_Albedo(albedo), m_DiffuseColor(diffuseColor), m_SpecularExponent(specularExponent) {}
+		: m_RefractiveIndex(refractiveIndex), m_Albedo(albedo), m_DiffuseColor(diffuseColor), m_SpecularExponent(specularExponent), m_Model(PhongModel), m_Roughness() {}
+
+	// Microfacet material. Fresnel decides how light splits between the terms,
+	// so the albedo only switches them on: a conductor has no diffuse and no
+	// refraction, a dielectric trades its diffuse base for refraction as it
+	// becomes transparent.
+	//
+	Material(const MaterialModel& model, const float& refractiveIndex, const Vec3f& color, const float& roughness, const float& transparency = 0.0f)
+		: m_RefractiveIndex(refractiveIndex), m_Albedo(), m_DiffuseColor(color), m_SpecularExponent(), m_Model(model), m_Roughness(roughness)
+	{
+		if (model == ConductorModel) m_Albedo = Vec4f(0.0f, 1.0f, 1.0f, 0.0f);
+		else m_Albedo = Vec4f(1.0f - transparency, 1.0f, 1.0f, transparency);
+	}
+
+	// Hash of every field (FNV-1a): equal materials, such as the two colors
+	// of the checkerboard wherever they appear, share an id.
+	uint32_t Id() const
+	{
+		float fields[11] = { m_RefractiveIndex, m_Albedo[0], m_Albedo[1], m_Albedo[2], m_Albedo[3],
+		                     m_DiffuseColor.x, m_DiffuseColor.y, m_DiffuseColor.z, m_SpecularExponent, (float)m_Model, m_Roughness };
+		unsigned char bytes[sizeof(fields)];
+		uint32_t hash = 2166136261u;
+
+		memcpy(bytes, fields, sizeof(fields));
+
+		for (size_t k = 0; k < sizeof(bytes); k++) hash = (hash ^ bytes[k]) * 16777619u;
+
+		return hash;
+	}
 };
 
-struct Sphere
+// Templated on the scalar type of its geometry; the material stays in float.
+template <typename T> struct SphereT
 {
-	Vec3f m_Center;
-	float m_Radius;
+	vec<3, T> m_Center;
+	T m_Radius;
 	Material m_Material;
 	
-	Sphere(const Vec3f& center, const float& radius, const Material& material)
+	SphereT(const vec<3, T>& center, const T& radius, const Material& material)
 		: m_Center(center), m_Radius(radius), m_Material(material) {}
 
-	bool RayIntersect(const Vec3f& origin, const Vec3f& direction, float& t) const
+	template <typename U> explicit SphereT(const SphereT<U>& other)
+		: m_Center(other.m_Center), m_Radius(T(other.m_Radius)), m_Material(other.m_Material) {}
+
+	bool RayIntersect(const vec<3, T>& origin, const vec<3, T>& direction, T& t) const
 	{
-		Vec3f xa = origin - m_Center;
-		float b = xa * direction;
-		float delta = (b * b) - (xa * xa) + (m_Radius * m_Radius);
+		vec<3, T> xa = origin - m_Center;
+		T b = xa * direction;
+		T delta = (b * b) - (xa * xa) + (m_Radius * m_Radius);
 
 		if (delta < 0) return false;
 
-		float s1 = - b - sqrtf(delta);
-		float s2 = - b + sqrtf(delta);
+		T s1 = - b - std::sqrt(delta);
+		T s2 = - b + std::sqrt(delta);
 
 		if (s1 > 0) { t = s1; return true; }
 		else if (s2 > 0) { t = s2; return true; }
 
 		return false;
 	}
-};
\ No newline at end of file
+};
+
+typedef SphereT<float> Sphere;
\ No newline at end of file
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+inline double Mean(const std::vector<double>& samples)
+{
+	double sum = 0.0;
+
+	for (size_t i = 0; i < samples.size(); i++) sum += samples[i];
+
+	return samples.empty() ? 0.0 : sum / samples.size();
+}
+
+// Unbiased sample variance.
+inline double Variance(const std::vector<double>& samples)
+{
+	if (samples.size() < 2) return 0.0;
+
+	double mean = Mean(samples), sum = 0.0;
+
+	for (size_t i = 0; i < samples.size(); i++) sum += (samples[i] - mean) * (samples[i] - mean);
+
+	return sum / (samples.size() - 1);
+}
+
+// Regularized incomplete beta function I_x(a, b), by its continued fraction
+// (Numerical Recipes, "betacf"), used for the Student t distribution.
+//
+inline double IncompleteBeta(double a, double b, double x)
+{
+	if (x <= 0.0) return 0.0;
+	if (x >= 1.0) return 1.0;
+
+	// The fraction converges quickly only below (a + 1) / (a + b + 2).
+	if (x > (a + 1.0) / (a + b + 2.0)) return 1.0 - IncompleteBeta(b, a, 1.0 - x);
+
+	const double tiny = 1e-300;
+	double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) + b * std::log(1.0 - x)) / a;
+
+	double c = 1.0, d = 1.0 - (a + b) * x / (a + 1.0);
+	if (std::fabs(d) < tiny) d = tiny;
+	d = 1.0 / d;
+
+	double f = d;
+
+	for (int m = 1; m <= 200; m++) {
+		// Even step, then odd step of the fraction.
+		double numerator = m * (b - m) * x / ((a + 2.0 * m - 1.0) * (a + 2.0 * m));
+
+		d = 1.0 + numerator * d; if (std::fabs(d) < tiny) d = tiny;
+		c = 1.0 + numerator / c; if (std::fabs(c) < tiny) c = tiny;
+		d = 1.0 / d;
+		f *= c * d;
+
+		numerator = -(a + m) * (a + b + m) * x / ((a + 2.0 * m) * (a + 2.0 * m + 1.0));
+
+		d = 1.0 + numerator * d; if (std::fabs(d) < tiny) d = tiny;
+		c = 1.0 + numerator / c; if (std::fabs(c) < tiny) c = tiny;
+		d = 1.0 / d;
+
+		double delta = c * d;
+		f *= delta;
+
+		if (std::fabs(delta - 1.0) < 1e-12) break;
+	}
+
+	return front * f;
+}
+
+// P(T > t) for Student's t with "df" degrees of freedom.
+inline double StudentTUpperTail(double t, double df)
+{
+	double tail = 0.5 * IncompleteBeta(0.5 * df, 0.5, df / (df + t * t));
+
+	return t >= 0.0 ? tail : 1.0 - tail;
+}
+
+// Welch's t-test of mean(b) < mean(a), not assuming equal variances.
+// m_PValue is one-sided: the chance of a drop at least this large if the
+// means were equal.
+//
+struct WelchTest
+{
+	double m_T;
+	double m_DegreesOfFreedom;
+	double m_PValue;
+
+	WelchTest(const std::vector<double>& a, const std::vector<double>& b)
+		: m_T(0.0), m_DegreesOfFreedom(0.0), m_PValue(1.0)
+	{
+		if (a.size() < 2 || b.size() < 2) return;
+
+		double va = Variance(a) / a.size(), vb = Variance(b) / b.size();
+
+		if (va + vb <= 0.0)
+		{
+			m_PValue = Mean(b) < Mean(a) ? 0.0 : 1.0;
+			return;
+		}
+
+		m_T = (Mean(a) - Mean(b)) / std::sqrt(va + vb);
+		m_DegreesOfFreedom = (va + vb) * (va + vb) / (va * va / (a.size() - 1) + vb * vb / (b.size() - 1));
+		m_PValue = StudentTUpperTail(m_T, m_DegreesOfFreedom);
+	}
+};
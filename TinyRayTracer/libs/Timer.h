@@ -0,0 +1,37 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+struct Timer
+{
+	std::chrono::steady_clock::time_point m_Start;
+
+	Timer() : m_Start(std::chrono::steady_clock::now()) {}
+
+	void Reset() { m_Start = std::chrono::steady_clock::now(); }
+
+	double Seconds() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_Start).count();
+	}
+};
+
+// Time stamp counter: cheap enough to read around every pixel. It ticks at a
+// constant rate on current x86 processors, not at the core clock. Elsewhere
+// nanoseconds are returned instead.
+//
+inline uint64_t ReadCycleCounter()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
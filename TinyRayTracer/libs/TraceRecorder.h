@@ -0,0 +1,131 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+
+#include "Parallel.h"
+
+// Timeline of what every thread did, written as Chrome trace JSON (open it in
+// chrome://tracing or ui.perfetto.dev). Each thread appends to its own ring
+// buffer, so recording takes no lock; when a buffer wraps, the oldest events
+// of that thread are dropped. Disabled, a scope costs one branch.
+//
+const size_t TraceCapacity = 1 << 16; // Events kept per thread.
+
+struct TraceEvent
+{
+	const char* m_Name; // A string literal, never copied.
+	int64_t m_Begin;    // Nanoseconds since the recorder was enabled.
+	int64_t m_End;
+	int m_Arg;          // Shown as "arg" when not negative, e.g. the tile index.
+};
+
+struct alignas(CacheLineSize) TraceBuffer
+{
+	std::vector<TraceEvent> m_Events;
+	uint64_t m_Count; // Events ever recorded; the ring index is m_Count % capacity.
+
+	TraceBuffer() : m_Count(0) {}
+};
+
+struct TraceRecorder
+{
+	bool m_Enabled;
+	std::chrono::steady_clock::time_point m_Start;
+	AlignedVector<TraceBuffer> m_Buffers;
+
+	TraceRecorder() : m_Enabled(false), m_Start(std::chrono::steady_clock::now()) {}
+
+	// One buffer per thread that may record, of "capacity" events each.
+	void Enable(int threads, size_t capacity)
+	{
+		m_Buffers.assign(threads, TraceBuffer());
+
+		for (size_t i = 0; i < m_Buffers.size(); i++) m_Buffers[i].m_Events.resize(capacity);
+
+		m_Start = std::chrono::steady_clock::now();
+		m_Enabled = true;
+	}
+
+	int64_t Now() const
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_Start).count();
+	}
+
+	void Record(const char* name, int64_t begin, int64_t end, int arg)
+	{
+		int thread = ThreadIndex();
+
+		if (thread >= (int)m_Buffers.size()) return;
+
+		TraceBuffer& buffer = m_Buffers[thread];
+		TraceEvent& event = buffer.m_Events[buffer.m_Count++ % buffer.m_Events.size()];
+
+		event.m_Name = name;
+		event.m_Begin = begin;
+		event.m_End = end;
+		event.m_Arg = arg;
+	}
+
+	// Complete ("X") events in microseconds, plus a name for every thread.
+	// Call it outside parallel regions.
+	//
+	bool Write(const char* path) const
+	{
+		std::ofstream ofs(path, std::ofstream::out | std::ofstream::binary);
+
+		ofs << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+		for (size_t t = 0; t < m_Buffers.size(); t++) {
+			const TraceBuffer& buffer = m_Buffers[t];
+			const size_t capacity = buffer.m_Events.size();
+			const uint64_t oldest = buffer.m_Count > capacity ? buffer.m_Count - capacity : 0;
+
+			ofs << (t == 0 ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+			    << ",\"args\":{\"name\":\"thread " << t << (t == 0 ? " (main)" : "") << "\"}}";
+
+			for (uint64_t k = oldest; k < buffer.m_Count; k++) {
+				const TraceEvent& event = buffer.m_Events[k % capacity];
+
+				ofs << ",\n{\"name\":\"" << event.m_Name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << t
+				    << ",\"ts\":" << event.m_Begin / 1000.0 << ",\"dur\":" << (event.m_End - event.m_Begin) / 1000.0;
+
+				if (event.m_Arg >= 0) ofs << ",\"args\":{\"arg\":" << event.m_Arg << "}";
+
+				ofs << "}";
+			}
+		}
+
+		ofs << "\n]}\n";
+
+		return ofs.good();
+	}
+
+	static TraceRecorder& Get()
+	{
+		static TraceRecorder recorder;
+
+		return recorder;
+	}
+};
+
+// Records the lifetime of the scope as one event of the calling thread.
+struct TraceScope
+{
+	const char* m_Name;
+	int m_Arg;
+	int64_t m_Begin;
+
+	explicit TraceScope(const char* name, int arg = -1)
+		: m_Name(name), m_Arg(arg), m_Begin(TraceRecorder::Get().m_Enabled ? TraceRecorder::Get().Now() : 0) {}
+
+	~TraceScope()
+	{
+		TraceRecorder& recorder = TraceRecorder::Get();
+
+		if (recorder.m_Enabled) recorder.Record(m_Name, m_Begin, recorder.Now(), m_Arg);
+	}
+};
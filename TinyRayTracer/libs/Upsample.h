@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+
+#include "Geometry.h"
+#include "Framebuffer.h"
+#include "Checkerboard.h"
+
+const float UpsampleSpatialSigma = 0.6f;    // Of the spatial Gaussian, in low resolution pixels.
+const float UpsamplePlaneTolerance = 0.02f; // Distance off the pixel's tangent plane, relative to its depth.
+const float UpsampleMinWeight = 1e-3f;      // Below this no low resolution sample fits.
+
+// What the filter reads of a low resolution pixel, in one place.
+struct UpsampleSample
+{
+	Vec3f m_Color;
+	Vec3f m_Point;
+	Vec3f m_Normal;
+	uint32_t m_Material; // 0 for a miss, as in PixelGuide.
+};
+
+// Joint bilateral upsampling of an image rendered at 1 / factor of the
+// resolution. The full resolution guides, from primary rays alone, decide
+// which of the 4 x 4 low resolution samples around a pixel belong to the
+// same surface: the hit or miss and the material must match, the sample
+// must lie near the pixel's tangent plane, and its normal close to the
+// pixel's. A sphere edge or a checker edge thus cuts the filter, and stays
+// as sharp as the guides are.
+//
+// Pixels that no sample fits, thin features the low resolution missed, are
+// set in "fallback" to be traced at full resolution. Returns their number.
+//
+inline size_t UpsampleGuided(const Framebuffer& low, const GuideBuffer& lowGuides, const PinholeCamera& lowCamera,
+                             const GuideBuffer& guides, const PinholeCamera& camera, int factor, Framebuffer& framebuffer, RenderRegion& fallback)
+{
+	const int width = framebuffer.m_Width, height = framebuffer.m_Height;
+	std::vector<UpsampleSample> samples(size_t(low.m_Width) * low.m_Height);
+	std::vector<float> spatial(factor * 4);
+	size_t missing = 0;
+
+	// Pixel offsets repeat every "factor" pixels, and so do the spatial
+	// weights of the four samples along each axis.
+	for (int k = 0; k < factor; k++) {
+		const float u = (k + 0.5f) / factor - 0.5f;
+
+		for (int n = 0; n < 4; n++) {
+			const float d = n - 1 - (u - std::floor(u));
+
+			spatial[k * 4 + n] = std::exp(-0.5f * d * d / (UpsampleSpatialSigma * UpsampleSpatialSigma));
+		}
+	}
+
+	for (int j = 0; j < low.m_Height; j++) {
+		for (int i = 0; i < low.m_Width; i++) {
+			const PixelGuide& guide = lowGuides(i, j);
+			UpsampleSample& sample = samples[i + size_t(j) * low.m_Width];
+
+			sample.m_Color = low(i, j);
+			sample.m_Normal = guide.m_Normal;
+			sample.m_Material = guide.m_Material;
+
+			if (!std::isinf(guide.m_Depth)) sample.m_Point = lowCamera.m_Eye + lowCamera.Direction(i, j) * guide.m_Depth;
+		}
+	}
+
+	fallback.m_MaskWidth = width;
+	fallback.m_Mask.assign(size_t(width) * height, 0);
+
+	#pragma omp parallel for schedule(static) reduction(+ : missing)
+	for (int j = 0; j < height; j++) {
+		const float v = (j + 0.5f) / factor - 0.5f;
+		const int j0 = (int)std::floor(v) - 1;
+
+		for (int i = 0; i < width; i++) {
+			const float u = (i + 0.5f) / factor - 0.5f;
+			const int i0 = (int)std::floor(u) - 1;
+			const PixelGuide& guide = guides(i, j);
+			const bool miss = std::isinf(guide.m_Depth);
+			const float origin = miss ? 0.0f : (camera.m_Eye + camera.Direction(i, j) * guide.m_Depth) * guide.m_Normal;
+			const float plane = miss ? 0.0f : 1.0f / (UpsamplePlaneTolerance * guide.m_Depth * UpsamplePlaneTolerance * guide.m_Depth);
+			const float* wu = &spatial[(i % factor) * 4];
+			const float* wv = &spatial[(j % factor) * 4];
+
+			Vec3f sum;
+			float weights = 0.0f;
+
+			for (int lj = std::max(j0, 0); lj < std::min(j0 + 4, low.m_Height); lj++) {
+				for (int li = std::max(i0, 0); li < std::min(i0 + 4, low.m_Width); li++) {
+					const UpsampleSample& sample = samples[li + size_t(lj) * low.m_Width];
+
+					if (sample.m_Material != guide.m_Material) continue;
+
+					float weight = wu[li - i0] * wv[lj - j0];
+
+					if (!miss)
+					{
+						// A rational fall-off off the tangent plane: cheaper than a Gaussian, and as sharp.
+						const float offset = sample.m_Point * guide.m_Normal - origin;
+						const float distance = 1.0f / (1.0f + plane * offset * offset);
+						float facing = std::max(0.0f, sample.m_Normal * guide.m_Normal);
+
+						facing *= facing;
+						facing *= facing;
+						weight *= distance * distance * facing * facing;
+					}
+
+					sum = sum + sample.m_Color * weight;
+					weights += weight;
+				}
+			}
+
+			if (weights < UpsampleMinWeight)
+			{
+				fallback.m_Mask[i + size_t(j) * width] = 1;
+				missing++;
+				continue;
+			}
+
+			framebuffer(i, j) = sum * (1.0f / weights);
+		}
+	}
+
+	return missing;
+}